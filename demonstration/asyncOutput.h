@@ -0,0 +1,248 @@
+// ASYNCHRONOUS BUFFERED TERMINAL OUTPUT
+#ifndef ASYNC_OUTPUT_H
+#define ASYNC_OUTPUT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <unistd.h>
+
+/* ASYNCHRONOUS OUTPUT:
+ * ====================
+ * Writing "std::cout << ... << std::endl" FLUSHES std::cout, so every
+ * line costs a separate write() SYSTEM CALL. For programs that print a
+ * large number of lines this dominates the run time.
+ *
+ * The asyncOut() stream defined here is a drop-in replacement for
+ * std::cout. Each thread formats its output into its OWN buffer (so no
+ * locking is needed while formatting), and only FULL buffers are handed
+ * to a single BACKGROUND WRITER THREAD that writes them to the terminal.
+ * std::endl still ends the line but NO LONGER forces a system call.
+ *
+ * FLUSH-AT-EXIT GUARANTEE: Any output still buffered when a thread
+ * finishes, or when the program returns from main() or calls std::exit(),
+ * is written before the program ends. Call asyncFlush() to force all of
+ * the calling thread's output to be written immediately, e.g. before
+ * writing to the terminal by other means.
+ */
+class AsyncOutputSink {
+
+  std::mutex mutex;
+  std::condition_variable bufferReady;
+  std::condition_variable bufferWritten;
+  std::deque<std::string> pending;
+  std::uint64_t submittedCount;
+  std::uint64_t writtenCount;
+  bool stopping;
+  std::thread writer;
+
+  AsyncOutputSink():
+    submittedCount(0),
+    writtenCount(0),
+    stopping(false)
+  {
+    writer = std::thread(&AsyncOutputSink::run, this);
+  }
+
+  // Body of the background writer thread.
+  void run(){
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;){
+      bufferReady.wait(lock, [this](){ return stopping || !pending.empty(); });
+      if(pending.empty()){
+	return; // Stopping and nothing left to write.
+      }
+      std::string buffer(std::move(pending.front()));
+      pending.pop_front();
+      // Release the lock so that other threads can submit during the write.
+      lock.unlock();
+      writeFully(buffer);
+      lock.lock();
+      ++writtenCount;
+      bufferWritten.notify_all();
+    }
+  }
+
+  static void writeFully(const std::string & buffer){
+    const char * data = buffer.data();
+    std::size_t remaining = buffer.size();
+    while(remaining > 0){
+      ssize_t written = ::write(STDOUT_FILENO, data, remaining);
+      if(written <= 0){
+	return; // Nothing more can be done if the terminal is gone.
+      }
+      data += written;
+      remaining -= written;
+    }
+  }
+
+public :
+
+  AsyncOutputSink(const AsyncOutputSink &) = delete;
+  AsyncOutputSink & operator=(const AsyncOutputSink &) = delete;
+
+  // Write any remaining buffers, then stop the writer thread.
+  ~AsyncOutputSink()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    bufferReady.notify_one();
+    writer.join();
+  }
+
+  // The single, program-wide sink.
+  static AsyncOutputSink & instance(){
+    static AsyncOutputSink sink;
+    return sink;
+  }
+
+  /* Queue a buffer for writing and return the number of buffers queued
+   * so far, which can be passed to waitUntilWritten().
+   */
+  std::uint64_t submit(std::string && buffer){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!buffer.empty()){
+      pending.push_back(std::move(buffer));
+      ++submittedCount;
+      bufferReady.notify_one();
+    }
+    return submittedCount;
+  }
+
+  // Block until the first "count" buffers have been written.
+  void waitUntilWritten(std::uint64_t count){
+    std::unique_lock<std::mutex> lock(mutex);
+    bufferWritten.wait(lock, [this, count](){ return writtenCount >= count; });
+  }
+
+};
+
+/* Stream buffer that collects one thread's output and hands it to the
+ * sink in large blocks.
+ */
+class AsyncOutputBuffer : public std::streambuf {
+
+  static const std::size_t capacity = 1 << 16;
+  std::string storage;
+
+  void startBuffer(){
+    storage.assign(capacity, '\0');
+    setp(&storage[0], &storage[0] + capacity);
+  }
+
+protected :
+
+  // Called when the buffer is full.
+  int_type overflow(int_type character) override {
+    handOff();
+    if(!traits_type::eq_int_type(character, traits_type::eof())){
+      *pptr() = traits_type::to_char_type(character);
+      pbump(1);
+    }
+    return traits_type::not_eof(character);
+  }
+
+  /* Called by std::endl and std::flush. Deliberately does nothing, which
+   * is what avoids a system call per line.
+   */
+  int sync() override {
+    return 0;
+  }
+
+public :
+
+  AsyncOutputBuffer()
+  {
+    startBuffer();
+  }
+
+  ~AsyncOutputBuffer()
+  {
+    handOff();
+  }
+
+  // Pass everything buffered so far to the sink.
+  std::uint64_t handOff(){
+    storage.resize(pptr() - pbase());
+    std::uint64_t submitted = AsyncOutputSink::instance().submit(std::move(storage));
+    startBuffer();
+    return submitted;
+  }
+
+};
+
+// An output stream that writes through the calling thread's buffer.
+class AsyncOutputStream : public std::ostream {
+
+  AsyncOutputBuffer buffer;
+
+public :
+
+  AsyncOutputStream():
+    std::ostream(nullptr)
+  {
+    rdbuf(&buffer);
+  }
+
+  AsyncOutputBuffer & getBuffer(){
+    return buffer;
+  }
+
+};
+
+/* The calling thread's output stream. Use it exactly like std::cout.
+ * NOTE: The sink is created BEFORE the thread's stream, which guarantees
+ *       that it is destroyed AFTER the stream has handed off its output.
+ */
+inline AsyncOutputStream & asyncStream(){
+  AsyncOutputSink::instance();
+  thread_local AsyncOutputStream stream;
+  return stream;
+}
+
+inline std::ostream & asyncOut(){
+  return asyncStream();
+}
+
+// Write everything the calling thread has output so far, and wait.
+inline void asyncFlush(){
+  AsyncOutputSink::instance().waitUntilWritten(asyncStream().getBuffer().handOff());
+}
+
+/* While an instance of this class exists, the calling thread's asyncOut()
+ * writes to a different stream buffer, for example to capture or discard
+ * output. Only the CALLING thread is affected.
+ */
+class AsyncOutputRedirect {
+
+  std::ostream & stream;
+  std::streambuf * previous;
+
+public :
+
+  explicit AsyncOutputRedirect(std::streambuf * target):
+    stream(asyncOut()),
+    previous(stream.rdbuf(target))
+  {}
+
+  AsyncOutputRedirect(const AsyncOutputRedirect &) = delete;
+  AsyncOutputRedirect & operator=(const AsyncOutputRedirect &) = delete;
+
+  ~AsyncOutputRedirect()
+  {
+    stream.rdbuf(previous);
+  }
+
+};
+
+#endif // ASYNC_OUTPUT_H
@@ -0,0 +1,472 @@
+// TRANSPARENTLY COMPRESSED FILE STREAMS
+#ifndef COMPRESSED_STREAMS_H
+#define COMPRESSED_STREAMS_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Compression libraries are optional. Compile with
+ *   -DSTLINTRO_ZLIB -lz      to support gzip (.gz) files
+ *   -DSTLINTRO_ZSTD -lzstd   to support Zstandard (.zst) files
+ */
+#ifdef STLINTRO_ZLIB
+#include <zlib.h>
+#endif
+#ifdef STLINTRO_ZSTD
+#include <zstd.h>
+#endif
+
+/* COMPRESSED STREAMS:
+ * ===================
+ * The functions openInputFile() and openOutputFile() return ordinary
+ * std::istream and std::ostream objects, so the code that reads and
+ * writes numbers does not need to know whether a file is compressed.
+ *
+ * - An input file is recognized as compressed from the MAGIC NUMBER in
+ *   its first bytes. It is decompressed by a SEPARATE THREAD, one block
+ *   at a time, while the main thread parses the previous block. At most
+ *   a few blocks are held in memory at once, however large the file.
+ * - An output file is compressed if its name ends in ".gz" or ".zst".
+ *   Each large block of output is compressed INDEPENDENTLY, by several
+ *   threads in parallel, as a complete gzip member or Zstandard frame.
+ *   Concatenated members (frames) form a valid compressed file.
+ */
+enum CompressionFormat { UNCOMPRESSED, GZIP_FORMAT, ZSTD_FORMAT };
+
+inline const char * compressionName(CompressionFormat format){
+  return format == GZIP_FORMAT ? "gzip" : (format == ZSTD_FORMAT ? "zstd" : "uncompressed");
+}
+
+inline bool compressionSupported(CompressionFormat format){
+#ifdef STLINTRO_ZLIB
+  if(format == GZIP_FORMAT){
+    return true;
+  }
+#endif
+#ifdef STLINTRO_ZSTD
+  if(format == ZSTD_FORMAT){
+    return true;
+  }
+#endif
+  return format == UNCOMPRESSED;
+}
+
+// Identify a compressed file from its first four bytes.
+inline CompressionFormat detectCompression(const std::string & fileName){
+  unsigned char magic[4] = {0, 0, 0, 0};
+  std::ifstream file(fileName.c_str(), std::ios::binary);
+  file.read(reinterpret_cast<char *>(magic), sizeof(magic));
+  if(file.gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b){
+    return GZIP_FORMAT;
+  }
+  if(file.gcount() == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+     && magic[2] == 0x2f && magic[3] == 0xfd){
+    return ZSTD_FORMAT;
+  }
+  return UNCOMPRESSED;
+}
+
+// Choose the compression of an output file from its extension.
+inline CompressionFormat compressionFromName(const std::string & fileName){
+  std::size_t length = fileName.size();
+  if(length > 3 && fileName.compare(length - 3, 3, ".gz") == 0){
+    return GZIP_FORMAT;
+  }
+  if(length > 4 && fileName.compare(length - 4, 4, ".zst") == 0){
+    return ZSTD_FORMAT;
+  }
+  return UNCOMPRESSED;
+}
+
+/* Stream buffer whose characters are produced by a decompression thread.
+ * Blocks are passed from that thread through a BOUNDED queue, so the
+ * decompressor can only run a few blocks ahead of the reader.
+ */
+class DecompressingInputBuffer : public std::streambuf {
+
+  static const std::size_t blockSize = 1 << 20;
+  static const std::size_t maximumQueuedBlocks = 4;
+
+  std::ifstream file;
+  CompressionFormat format;
+  std::mutex mutex;
+  std::condition_variable blockReady;
+  std::condition_variable spaceReady;
+  std::deque<std::string> blocks;
+  bool finished;   // Decompression thread has produced its last block
+  bool cancelled;  // Reader has gone away
+  bool failed;
+  std::string current;
+  std::thread decompressor;
+
+  // Called by the decompression thread. Returns false if cancelled.
+  bool pushBlock(std::string & block){
+    std::unique_lock<std::mutex> lock(mutex);
+    spaceReady.wait(lock, [this](){ return cancelled || blocks.size() < maximumQueuedBlocks; });
+    if(cancelled){
+      return false;
+    }
+    blocks.push_back(std::string());
+    blocks.back().swap(block);
+    blockReady.notify_one();
+    return true;
+  }
+
+  void finish(bool success){
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    failed = !success;
+    blockReady.notify_one();
+  }
+
+  // Body of the decompression thread.
+  void run(){
+    std::vector<char> input(1 << 18);
+    std::string output;
+    bool success = false;
+#ifdef STLINTRO_ZLIB
+    if(format == GZIP_FORMAT){
+      z_stream stream;
+      std::memset(&stream, 0, sizeof(stream));
+      // 15 + 32 accepts both gzip and zlib headers.
+      if(inflateInit2(&stream, 15 + 32) == Z_OK){
+	int status = Z_OK;
+	success = true;
+	while(success){
+	  if(stream.avail_in == 0){
+	    file.read(input.data(), input.size());
+	    if(file.gcount() == 0){
+	      // Input ended; it must end exactly at the end of a member.
+	      success = status == Z_STREAM_END;
+	      break;
+	    }
+	    stream.next_in = reinterpret_cast<Bytef *>(input.data());
+	    stream.avail_in = static_cast<uInt>(file.gcount());
+	  }
+	  if(status == Z_STREAM_END){
+	    // Another gzip member follows the one that has just ended.
+	    inflateReset(&stream);
+	  }
+	  std::size_t used = output.size();
+	  output.resize(blockSize);
+	  stream.next_out = reinterpret_cast<Bytef *>(&output[used]);
+	  stream.avail_out = static_cast<uInt>(blockSize - used);
+	  status = inflate(&stream, Z_NO_FLUSH);
+	  output.resize(blockSize - stream.avail_out);
+	  if(status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR){
+	    std::cerr << "gzip: " << (stream.msg ? stream.msg : "corrupt input") << std::endl;
+	    success = false;
+	  }
+	  if(output.size() == blockSize && !pushBlock(output)){
+	    break;
+	  }
+	}
+	inflateEnd(&stream);
+      }
+    }
+#endif
+#ifdef STLINTRO_ZSTD
+    if(format == ZSTD_FORMAT){
+      ZSTD_DStream * stream = ZSTD_createDStream();
+      ZSTD_inBuffer inBuffer = {input.data(), 0, 0};
+      std::size_t status = 0;
+      success = stream != nullptr;
+      while(success){
+	if(inBuffer.pos == inBuffer.size){
+	  file.read(input.data(), input.size());
+	  if(file.gcount() == 0){
+	    // A status of zero means the last frame was complete.
+	    success = status == 0;
+	    break;
+	  }
+	  inBuffer.size = static_cast<std::size_t>(file.gcount());
+	  inBuffer.pos = 0;
+	}
+	std::size_t used = output.size();
+	output.resize(blockSize);
+	ZSTD_outBuffer outBuffer = {&output[0], blockSize, used};
+	status = ZSTD_decompressStream(stream, &outBuffer, &inBuffer);
+	output.resize(outBuffer.pos);
+	if(ZSTD_isError(status)){
+	  std::cerr << "zstd: " << ZSTD_getErrorName(status) << std::endl;
+	  success = false;
+	}
+	if(output.size() == blockSize && !pushBlock(output)){
+	  break;
+	}
+      }
+      ZSTD_freeDStream(stream);
+    }
+#endif
+    if(success && !output.empty()){
+      pushBlock(output);
+    }
+    finish(success);
+  }
+
+protected :
+
+  // Called when every character of the current block has been read.
+  int_type underflow() override {
+    std::unique_lock<std::mutex> lock(mutex);
+    blockReady.wait(lock, [this](){ return finished || !blocks.empty(); });
+    if(blocks.empty()){
+      if(failed){
+	// Input streams report exceptions from their buffer as badbit.
+	throw std::ios_base::failure("decompression failed");
+      }
+      return traits_type::eof();
+    }
+    current.swap(blocks.front());
+    blocks.pop_front();
+    spaceReady.notify_one();
+    setg(&current[0], &current[0], &current[0] + current.size());
+    return traits_type::to_int_type(current[0]);
+  }
+
+public :
+
+  DecompressingInputBuffer(const std::string & fileName, CompressionFormat format):
+    file(fileName.c_str(), std::ios::binary),
+    format(format),
+    finished(false),
+    cancelled(false),
+    failed(false)
+  {
+    decompressor = std::thread(&DecompressingInputBuffer::run, this);
+  }
+
+  DecompressingInputBuffer(const DecompressingInputBuffer &) = delete;
+  DecompressingInputBuffer & operator=(const DecompressingInputBuffer &) = delete;
+
+  ~DecompressingInputBuffer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      cancelled = true;
+    }
+    spaceReady.notify_one();
+    decompressor.join();
+  }
+
+};
+
+/* Stream buffer that compresses each full block of output on a separate
+ * thread. Compressed blocks are written to the file IN ORDER, and only a
+ * limited number of blocks are compressed at once.
+ */
+class CompressingOutputBuffer : public std::streambuf {
+
+  static const std::size_t blockSize = 1 << 20;
+
+  std::ofstream file;
+  CompressionFormat format;
+  std::size_t maximumInFlight;
+  std::deque<std::future<std::string> > inFlight;
+  std::string current;
+  bool anyBlockWritten;
+  bool failed;
+
+  static std::string compressBlock(CompressionFormat format, std::string block){
+    std::string compressed;
+    (void)format; // Unused when built without any compression library.
+    (void)block;
+#ifdef STLINTRO_ZLIB
+    if(format == GZIP_FORMAT){
+      z_stream stream;
+      std::memset(&stream, 0, sizeof(stream));
+      // 15 + 16 writes a gzip header and trailer around the data.
+      if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		      Z_DEFAULT_STRATEGY) != Z_OK){
+	return compressed;
+      }
+      compressed.resize(deflateBound(&stream, block.size()) + 32);
+      stream.next_in = reinterpret_cast<Bytef *>(&block[0]);
+      stream.avail_in = static_cast<uInt>(block.size());
+      stream.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+      stream.avail_out = static_cast<uInt>(compressed.size());
+      int status = deflate(&stream, Z_FINISH);
+      compressed.resize(status == Z_STREAM_END ? stream.total_out : 0);
+      deflateEnd(&stream);
+    }
+#endif
+#ifdef STLINTRO_ZSTD
+    if(format == ZSTD_FORMAT){
+      compressed.resize(ZSTD_compressBound(block.size()));
+      std::size_t size = ZSTD_compress(&compressed[0], compressed.size(),
+				       block.data(), block.size(), 3);
+      compressed.resize(ZSTD_isError(size) ? 0 : size);
+    }
+#endif
+    return compressed;
+  }
+
+  // Write the oldest compressed block to the file.
+  void writeOldest(){
+    std::string compressed = inFlight.front().get();
+    inFlight.pop_front();
+    if(compressed.empty()){
+      failed = true;
+    }
+    file.write(compressed.data(), compressed.size());
+    failed = failed || !file.good();
+  }
+
+  // Start compressing the current block.
+  void handOff(){
+    std::size_t used = pptr() - pbase();
+    if(used > 0){
+      current.resize(used);
+      if(inFlight.size() >= maximumInFlight){
+	writeOldest();
+      }
+      inFlight.push_back(std::async(std::launch::async, compressBlock, format, std::move(current)));
+      anyBlockWritten = true;
+    }
+    current.assign(blockSize, '\0');
+    setp(&current[0], &current[0] + blockSize);
+  }
+
+protected :
+
+  int_type overflow(int_type character) override {
+    handOff();
+    if(!traits_type::eq_int_type(character, traits_type::eof())){
+      *pptr() = traits_type::to_char_type(character);
+      pbump(1);
+    }
+    return failed ? traits_type::eof() : traits_type::not_eof(character);
+  }
+
+  // Compress and write everything output so far.
+  int sync() override {
+    handOff();
+    while(!inFlight.empty()){
+      writeOldest();
+    }
+    file.flush();
+    return failed || !file.good() ? -1 : 0;
+  }
+
+public :
+
+  CompressingOutputBuffer(const std::string & fileName, CompressionFormat format):
+    file(fileName.c_str(), std::ios::binary | std::ios::trunc),
+    format(format),
+    maximumInFlight(2 * std::max(1u, std::thread::hardware_concurrency())),
+    anyBlockWritten(false),
+    failed(!file.is_open())
+  {
+    current.assign(blockSize, '\0');
+    setp(&current[0], &current[0] + blockSize);
+  }
+
+  CompressingOutputBuffer(const CompressingOutputBuffer &) = delete;
+  CompressingOutputBuffer & operator=(const CompressingOutputBuffer &) = delete;
+
+  ~CompressingOutputBuffer()
+  {
+    // An empty compressed file still needs one (empty) member or frame.
+    if(!anyBlockWritten && !failed){
+      std::string empty = compressBlock(format, std::string());
+      file.write(empty.data(), empty.size());
+    }
+    sync();
+  }
+
+};
+
+// An input stream that owns its decompressing buffer.
+class DecompressingInputStream : public std::istream {
+
+  DecompressingInputBuffer buffer;
+
+public :
+
+  DecompressingInputStream(const std::string & fileName, CompressionFormat format):
+    std::istream(nullptr),
+    buffer(fileName, format)
+  {
+    rdbuf(&buffer);
+  }
+
+};
+
+// An output stream that owns its compressing buffer.
+class CompressingOutputStream : public std::ostream {
+
+  CompressingOutputBuffer buffer;
+
+public :
+
+  CompressingOutputStream(const std::string & fileName, CompressionFormat format):
+    std::ostream(nullptr),
+    buffer(fileName, format)
+  {
+    rdbuf(&buffer);
+  }
+
+};
+
+/* Open a file for reading, decompressing it if necessary. Returns a null
+ * pointer if the file cannot be opened or its compression is not
+ * supported by this build.
+ */
+inline std::unique_ptr<std::istream> openInputFile(const std::string & fileName){
+  std::unique_ptr<std::istream> input;
+  CompressionFormat format = detectCompression(fileName);
+  if(!compressionSupported(format)){
+    std::cerr << fileName << " is " << compressionName(format)
+	      << " compressed, but this program was built without "
+	      << compressionName(format) << " support" << std::endl;
+  }
+  else if(format == UNCOMPRESSED){
+    input.reset(new std::ifstream(fileName.c_str()));
+  }
+  else{
+    input.reset(new DecompressingInputStream(fileName, format));
+  }
+  if(input && !input->good()){
+    input.reset();
+  }
+  return input;
+}
+
+/* Open a file for writing, compressing it if its name ends in ".gz" or
+ * ".zst". Returns a null pointer on failure.
+ */
+inline std::unique_ptr<std::ostream> openOutputFile(const std::string & fileName){
+  std::unique_ptr<std::ostream> output;
+  CompressionFormat format = compressionFromName(fileName);
+  if(!compressionSupported(format)){
+    std::cerr << "This program was built without " << compressionName(format)
+	      << " support, needed to write " << fileName << std::endl;
+  }
+  else if(format == UNCOMPRESSED){
+    output.reset(new std::ofstream(fileName.c_str()));
+  }
+  else{
+    output.reset(new CompressingOutputStream(fileName, format));
+  }
+  if(output && !output->good()){
+    output.reset();
+  }
+  return output;
+}
+
+#endif // COMPRESSED_STREAMS_H
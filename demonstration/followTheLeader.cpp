@@ -1,5 +1,21 @@
-#include <iostream>
 #include <string>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <memory>
+#include <new>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "asyncOutput.h"
+#include "staticDispatch.h"
 
 class Base {
 
@@ -20,7 +36,14 @@ public :
   }
   
   void declare(){
-    std::cout << "I'm " << getName() << "!" << std::endl;
+    asyncOut() << "I'm " << getName() << "!" << std::endl;
+  }
+
+  // Append the declaration to a string instead of printing it.
+  void declare(std::string & output){
+    output += "I'm ";
+    output += getName();
+    output += "!\n";
   }
   
 };
@@ -39,6 +62,13 @@ public :
   
 };
 
+// Copy a null-terminated string to "output", returning the end of the copy.
+inline char * appendText(char * output, const char * text){
+  std::size_t length = std::strlen(text);
+  std::memcpy(output, text, length);
+  return output + length;
+}
+
 class ReDerived : public Derived {
 
   bool hasBravery;
@@ -57,28 +87,262 @@ public :
 
   void declare(){
     if(hasBravery){
-      std::cout << "No! I'm " << getName() << "!" << std::endl;
+      asyncOut() << "No! I'm " << getName() << "!" << std::endl;
     }
     else{
-      std::cout << "I'm " << getName() << ". Pleased to meet you, general." << std::endl;
+      asyncOut() << "I'm " << getName() << ". Pleased to meet you, general." << std::endl;
     }
   }
 
+  // The number of bytes that declare(char *) writes.
+  std::size_t declarationLength(){
+    return getName().size() + std::strlen(hasBravery ? "No! I'm !\n"
+					  : "I'm . Pleased to meet you, general.\n");
+  }
+
+  /* Write the declaration to "output", which must have room for
+   * declarationLength() bytes, and return the end of what was written.
+   */
+  char * declare(char * output){
+    std::string name = getName();
+    if(hasBravery){
+      output = appendText(output, "No! I'm ");
+      output = std::copy(name.begin(), name.end(), output);
+      return appendText(output, "!\n");
+    }
+    output = appendText(output, "I'm ");
+    output = std::copy(name.begin(), name.end(), output);
+    return appendText(output, ". Pleased to meet you, general.\n");
+  }
+
 };
 
 
+/* An ARENA holds up to a fixed number of objects of one type in a single
+ * contiguous block of memory that is allocated once. Constructing an 
+ * object in the arena needs no further allocation, and iterating over 
+ * the objects walks through memory in order.
+ */
+template<typename T>
+class ObjectArena {
 
-int main(int argc, char * argv[]){
+  T * objects;
+  std::size_t capacity;
+  std::size_t count;
+
+public :
 
+  explicit ObjectArena(std::size_t capacity):
+    objects(static_cast<T *>(::operator new(capacity * sizeof(T)))),
+    capacity(capacity),
+    count(0)
+  {}
+
+  ObjectArena(const ObjectArena &) = delete;
+  ObjectArena & operator=(const ObjectArena &) = delete;
+
+  ~ObjectArena()
+  {
+    for(std::size_t index = 0; index < count; ++index){
+      objects[index].~T();
+    }
+    ::operator delete(objects);
+  }
+
+  /* Construct a new object at the end of the arena using PLACEMENT NEW.
+   * The arena never grows, so this throws once it is full.
+   */
+  template<typename... Arguments>
+  T & emplace(Arguments &&... arguments){
+    if(count == capacity){
+      throw std::length_error("ObjectArena is full");
+    }
+    T * object = new (objects + count) T(std::forward<Arguments>(arguments)...);
+    ++count;
+    return *object;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  T * begin(){
+    return objects;
+  }
+
+  T * end(){
+    return objects + count;
+  }
+
+};
+
+/* Generate a leader and a CROWD of followers, then render every
+ * declaration IN PARALLEL into one buffer that is written with a single
+ * system call. A fraction "braveFraction" of the followers are brave.
+ */
+int followTheCrowd(std::size_t followerCount, double braveFraction, unsigned int threadCount){
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  /* Brave followers are default-constructed (and so are all Spartacus),
+   * the others are Batiatus. Followers are spread evenly through the 
+   * crowd so that exactly the requested fraction is brave.
+   */
   Base leader;
-  Derived firstFollower;
-  ReDerived secondFollower;
-  ReDerived thirdFollower("Batiatus");
-
-  leader.declare();
-  firstFollower.declare();
-  secondFollower.declare();
-  thirdFollower.declare();
+  ObjectArena<ReDerived> crowd(followerCount);
+  for(std::size_t index = 0; index < followerCount; ++index){
+    bool isBrave = static_cast<std::size_t>((index + 1) * braveFraction) 
+      > static_cast<std::size_t>(index * braveFraction);
+    if(isBrave){
+      crowd.emplace();
+    }
+    else{
+      crowd.emplace("Batiatus");
+    }
+  }
+  std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+
+  /* Each thread renders one contiguous chunk of the crowd. The threads
+   * first MEASURE their chunks, so that a prefix sum gives the offset of
+   * each chunk in the buffer, then write their declarations directly at
+   * that offset. The text is never copied.
+   */
+  std::string leaderLine;
+  leader.declare(leaderLine);
+  std::size_t chunkSize = (followerCount + threadCount - 1) / threadCount;
+  std::vector<std::size_t> offsets(threadCount + 1, 0);
+  std::vector<std::thread> threads;
+  for(unsigned int thread = 0; thread < threadCount; ++thread){
+    threads.push_back(std::thread([&, thread](){
+	  std::size_t begin = std::min(followerCount, thread * chunkSize);
+	  std::size_t end = std::min(followerCount, begin + chunkSize);
+	  std::size_t length(0);
+	  for(ReDerived * follower = crowd.begin() + begin; follower != crowd.begin() + end; ++follower){
+	    length += follower->declarationLength();
+	  }
+	  offsets[thread + 1] = length;
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  threads.clear();
+  offsets[0] = leaderLine.size();
+  for(unsigned int thread = 0; thread < threadCount; ++thread){
+    offsets[thread + 1] += offsets[thread];
+  }
+
+  // The buffer is not initialized: every byte is written by one thread.
+  std::size_t bufferSize = offsets[threadCount];
+  std::unique_ptr<char[]> buffer(new char[bufferSize]);
+  std::memcpy(buffer.get(), leaderLine.data(), leaderLine.size());
+  for(unsigned int thread = 0; thread < threadCount; ++thread){
+    threads.push_back(std::thread([&, thread](){
+	  std::size_t begin = std::min(followerCount, thread * chunkSize);
+	  std::size_t end = std::min(followerCount, begin + chunkSize);
+	  char * output = buffer.get() + offsets[thread];
+	  for(ReDerived * follower = crowd.begin() + begin; follower != crowd.begin() + end; ++follower){
+	    output = follower->declare(output);
+	  }
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  std::chrono::steady_clock::time_point rendered = std::chrono::steady_clock::now();
+
+  /* Make sure anything already sent to asyncOut() appears first. A write
+   * to a pipe may be partial, in which case the rest is written next.
+   */
+  asyncFlush();
+  const char * data = buffer.get();
+  std::size_t remaining = bufferSize;
+  while(remaining > 0){
+    ssize_t written = ::write(STDOUT_FILENO, data, remaining);
+    if(written <= 0){
+      return 1;
+    }
+    data += written;
+    remaining -= written;
+  }
+  std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+
+  // Report on std::cerr so that std::cout can be redirected to a file.
+  std::chrono::duration<double> buildTime = built - start;
+  std::chrono::duration<double> renderTime = rendered - built;
+  std::chrono::duration<double> writeTime = finished - rendered;
+  std::chrono::duration<double> totalTime = finished - start;
+  std::cerr << followerCount << " followers, " << threadCount << " thread(s), "
+	    << bufferSize << " bytes\n"
+	    << "Build => " << buildTime.count() << " s\n"
+	    << "Render => " << renderTime.count() << " s\n"
+	    << "Write => " << writeTime.count() << " s\n"
+	    << "Agents per second => " << (followerCount + 1) / totalTime.count() 
+	    << std::endl;
+  return 0;
+}
+
+// Function object that calls declare() for any type of follower.
+struct Declare {
+  template<typename Follower>
+  void operator()(Follower & follower){
+    follower.declare();
+  }
+};
+
+/* Parse a whole command line argument as a count between 1 and maximum.
+ * Returns false if it is not a number or is out of range.
+ */
+bool parseCount(const char * argument, unsigned long long maximum, unsigned long long & count){
+  char * parsedEnd = nullptr;
+  errno = 0;
+  count = std::strtoull(argument, &parsedEnd, 10);
+  return parsedEnd != argument && *parsedEnd == '\0' && errno == 0
+    && argument[0] != '-' && count >= 1 && count <= maximum;
+}
+
+int main(int argc, char * argv[]){
+
+  /* With command line arguments, follow the leader with a whole crowd:
+   *   ./followTheLeader followerCount [braveFraction] [threadCount]
+   */
+  if(argc > 1){
+    const unsigned long long maximumThreads = 1024;
+    unsigned long long followerCount(0);
+    unsigned long long threadCount = std::max(1u, std::thread::hardware_concurrency());
+    if(!parseCount(argv[1], std::numeric_limits<std::size_t>::max() / sizeof(ReDerived),
+		   followerCount)
+       || (argc > 3 && !parseCount(argv[3], maximumThreads, threadCount))){
+      std::cerr << "Usage: " << argv[0] << " followerCount [braveFraction] [threadCount]\n"
+		<< "  followerCount and threadCount (at most " << maximumThreads
+		<< ") must be positive integers" << std::endl;
+      return 1;
+    }
+    double braveFraction(0.5);
+    if(argc > 2){
+      char * parsedEnd = nullptr;
+      braveFraction = std::strtod(argv[2], &parsedEnd);
+      if(parsedEnd == argv[2] || *parsedEnd != '\0' || !(braveFraction >= 0.0 && braveFraction <= 1.0)){
+	std::cerr << "Usage: " << argv[0] << " followerCount [braveFraction] [threadCount]\n"
+		  << "  braveFraction must be a number from 0 to 1" << std::endl;
+	return 1;
+      }
+    }
+    return followTheCrowd(followerCount, braveFraction, static_cast<unsigned int>(threadCount));
+  }
+
+  /* Keep everyone in one collection. Each type is stored in its own batch,
+   * so ReDerived::declare() is called for the ReDerived followers without
+   * needing a virtual method.
+   */
+  TypeSortedBatches<Base, Derived, ReDerived> everyone;
+  everyone.add(Base());
+  everyone.add(Derived());
+  everyone.add(ReDerived());
+  everyone.add(ReDerived("Batiatus"));
+
+  Declare declare;
+  everyone.forEach(declare);
   
   return 0;
 }
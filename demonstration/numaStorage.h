@@ -0,0 +1,315 @@
+// HUGE-PAGE BACKED, NUMA-AWARE STORAGE
+#ifndef NUMA_STORAGE_H
+#define NUMA_STORAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+/* NUMA AND HUGE PAGES:
+ * ====================
+ * On a machine with several processor SOCKETS, each socket has its own
+ * memory (a NUMA "node"). Reading memory attached to ANOTHER socket is
+ * slower, and crosses a link shared by every core.
+ *
+ * The operating system only chooses the node of a page when the page is
+ * first WRITTEN ("FIRST TOUCH"), placing it on the node of the writing
+ * thread. A std::vector that is filled by ONE thread therefore ends up
+ * ENTIRELY on one node. Instead the buffers below are allocated WITHOUT
+ * touching them, so each worker thread can first touch the part that it
+ * will later process.
+ *
+ * Every page also needs an entry in the processor's TLB cache of
+ * address translations. A 2 MiB HUGE PAGE replaces 512 ordinary 4 KiB
+ * pages, so large arrays cause far fewer TLB misses. Huge pages are
+ * either reserved explicitly by the administrator (MAP_HUGETLB), or
+ * provided "transparently" by the kernel when requested with
+ * madvise(MADV_HUGEPAGE).
+ */
+const std::size_t hugePageSize = std::size_t(2) << 20;
+
+template<typename T>
+class HugePageBuffer {
+
+  T * elements;
+  std::size_t count;
+  std::size_t mappedBytes;
+  bool explicitHugePages;
+
+public :
+
+  /* Elements per huge page. The memory starts on a huge page boundary, so
+   * a range starting at a multiple of this lies in its own huge pages.
+   */
+  static const std::size_t elementsPerHugePage = hugePageSize / sizeof(T);
+
+  /* Reserve space for "count" elements. The memory is NOT touched, so
+   * no page is placed on any node yet. Explicit huge pages are used if
+   * requested and available, otherwise transparent huge pages are
+   * requested.
+   */
+  HugePageBuffer(std::size_t count, bool useExplicitHugePages):
+    elements(nullptr),
+    count(count),
+    mappedBytes((count * sizeof(T) + hugePageSize - 1) / hugePageSize * hugePageSize),
+    explicitHugePages(false)
+  {
+    void * memory = MAP_FAILED;
+    if(mappedBytes == 0){
+      return;
+    }
+#ifdef MAP_HUGETLB
+    if(useExplicitHugePages){
+      memory = ::mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      explicitHugePages = memory != MAP_FAILED;
+    }
+#else
+    (void)useExplicitHugePages;
+#endif
+    if(memory == MAP_FAILED){
+      /* An ordinary mapping is only aligned to a 4 KiB page, but the kernel
+       * can only use a huge page for an ALIGNED 2 MiB range. One extra huge
+       * page is mapped, and the unaligned ends are unmapped again.
+       */
+      memory = ::mmap(nullptr, mappedBytes + hugePageSize, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(memory != MAP_FAILED){
+	char * mapped = static_cast<char *>(memory);
+	std::size_t head = (hugePageSize - reinterpret_cast<std::uintptr_t>(mapped) % hugePageSize)
+	  % hugePageSize;
+	if(head > 0){
+	  ::munmap(mapped, head);
+	}
+	::munmap(mapped + head + mappedBytes, hugePageSize - head);
+	memory = mapped + head;
+#ifdef MADV_HUGEPAGE
+	::madvise(memory, mappedBytes, MADV_HUGEPAGE);
+#endif
+      }
+    }
+    if(memory != MAP_FAILED){
+      elements = static_cast<T *>(memory);
+    }
+  }
+
+  HugePageBuffer(const HugePageBuffer &) = delete;
+  HugePageBuffer & operator=(const HugePageBuffer &) = delete;
+
+  ~HugePageBuffer()
+  {
+    if(elements != nullptr){
+      ::munmap(elements, mappedBytes);
+    }
+  }
+
+  // False if the memory could not be reserved.
+  bool valid() const {
+    return elements != nullptr || count == 0;
+  }
+
+  T * data(){
+    return elements;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  bool usesExplicitHugePages() const {
+    return explicitHugePages;
+  }
+
+};
+
+template<typename T>
+const std::size_t HugePageBuffer<T>::elementsPerHugePage;
+
+/* The processors of each NUMA node that this process may run on, read
+ * from /sys/devices/system/node/node<N>/cpulist. Worker threads are
+ * spread ROUND-ROBIN across the nodes: thread 0 on node 0, thread 1 on
+ * the next node, and so on. Pinning thread i to the i-th processor would
+ * instead put the first threads, and so all of the pages they first
+ * touch, on ONE node, since processors are usually numbered node by node.
+ *
+ * Without NUMA information every allowed processor is treated as one
+ * node.
+ */
+class NumaTopology {
+
+  std::vector<int> nodes;                        // Node numbers
+  std::vector<std::vector<int> > nodeProcessors; // Allowed processors of each
+
+  // Parse a processor list such as "0-3,8-11".
+  static std::vector<int> parseProcessorList(const std::string & list){
+    std::vector<int> processors;
+    std::istringstream ranges(list);
+    std::string range;
+    while(std::getline(ranges, range, ',')){
+      int first(0), last(0);
+      char dash('\0');
+      std::istringstream parser(range);
+      if(!(parser >> first)){
+	continue;
+      }
+      last = (parser >> dash >> last && dash == '-') ? last : first;
+      for(int processor = first; processor <= last; ++processor){
+	processors.push_back(processor);
+      }
+    }
+    return processors;
+  }
+
+public :
+
+  NumaTopology()
+  {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if(::sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+      return;
+    }
+    if(DIR * directory = ::opendir("/sys/devices/system/node")){
+      while(dirent * entry = ::readdir(directory)){
+	std::string name(entry->d_name);
+	if(name.compare(0, 4, "node") != 0 || name.size() == 4
+	   || name.find_first_not_of("0123456789", 4) != std::string::npos){
+	  continue;
+	}
+	std::ifstream cpuList(("/sys/devices/system/node/" + name + "/cpulist").c_str());
+	std::string list;
+	std::getline(cpuList, list);
+	std::vector<int> processors;
+	for(int processor : parseProcessorList(list)){
+	  if(processor < CPU_SETSIZE && CPU_ISSET(processor, &allowed)){
+	    processors.push_back(processor);
+	  }
+	}
+	// Nodes without usable processors (e.g. memory-only) are skipped.
+	if(!processors.empty()){
+	  nodes.push_back(std::atoi(name.c_str() + 4));
+	  nodeProcessors.push_back(processors);
+	}
+      }
+      ::closedir(directory);
+    }
+    // Order the nodes by number, since readdir() returns them in any order.
+    for(std::size_t sorted = 1; sorted < nodes.size(); ++sorted){
+      for(std::size_t node = sorted; node > 0 && nodes[node - 1] > nodes[node]; --node){
+	std::swap(nodes[node - 1], nodes[node]);
+	std::swap(nodeProcessors[node - 1], nodeProcessors[node]);
+      }
+    }
+    if(nodes.empty()){
+      std::vector<int> processors;
+      for(int processor = 0; processor < CPU_SETSIZE; ++processor){
+	if(CPU_ISSET(processor, &allowed)){
+	  processors.push_back(processor);
+	}
+      }
+      if(!processors.empty()){
+	nodes.push_back(0);
+	nodeProcessors.push_back(processors);
+      }
+    }
+#endif
+  }
+
+  std::size_t nodeCount() const {
+    return nodes.size();
+  }
+
+  // The node that a worker thread is pinned to, or -1 if unknown.
+  int nodeOfThread(std::size_t thread) const {
+    return nodes.empty() ? -1 : nodes[thread % nodes.size()];
+  }
+
+  /* Restrict the calling thread to one processor of the node chosen for
+   * worker "thread", so that the pages it first touches stay on that
+   * node. Returns false if unsupported.
+   */
+  bool pin(std::size_t thread) const {
+#ifdef __linux__
+    if(nodes.empty()){
+      return false;
+    }
+    const std::vector<int> & processors = nodeProcessors[thread % nodes.size()];
+    cpu_set_t only;
+    CPU_ZERO(&only);
+    CPU_SET(processors[(thread / nodes.size()) % processors.size()], &only);
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(only), &only) == 0;
+#else
+    (void)thread;
+    return false;
+#endif
+  }
+
+};
+
+/* Where the pages of a range of memory currently are. At most
+ * "maximumSamples" pages, evenly spaced, are examined.
+ */
+struct PagePlacement {
+  std::vector<std::size_t> pagesOnNode; // Indexed by node number
+  std::size_t pagesNotPresent = 0;      // Never touched, or swapped out
+  bool supported = false;
+};
+
+inline PagePlacement pagePlacement(const void * begin, const void * end,
+				   std::size_t maximumSamples = 1024){
+  PagePlacement placement;
+#if defined(__linux__) && defined(SYS_move_pages)
+  const std::uintptr_t pageSize = static_cast<std::uintptr_t>(::sysconf(_SC_PAGESIZE));
+  std::uintptr_t first = reinterpret_cast<std::uintptr_t>(begin) / pageSize;
+  std::uintptr_t last = (reinterpret_cast<std::uintptr_t>(end) + pageSize - 1) / pageSize;
+  if(begin >= end){
+    placement.supported = true;
+    return placement;
+  }
+  std::uintptr_t stride = (last - first + maximumSamples - 1) / maximumSamples;
+  std::vector<void *> pages;
+  for(std::uintptr_t page = first; page < last; page += stride){
+    pages.push_back(reinterpret_cast<void *>(page * pageSize));
+  }
+  std::vector<int> status(pages.size(), 0);
+  /* move_pages() with no target nodes moves nothing: it only reports the
+   * node of each page, or a negative error such as -ENOENT.
+   */
+  if(::syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0){
+    return placement;
+  }
+  placement.supported = true;
+  for(int node : status){
+    if(node < 0){
+      ++placement.pagesNotPresent;
+      continue;
+    }
+    if(placement.pagesOnNode.size() <= static_cast<std::size_t>(node)){
+      placement.pagesOnNode.resize(node + 1, 0);
+    }
+    ++placement.pagesOnNode[node];
+  }
+#else
+  (void)begin;
+  (void)end;
+  (void)maximumSamples;
+#endif
+  return placement;
+}
+
+#endif // NUMA_STORAGE_H
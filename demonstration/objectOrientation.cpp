@@ -5,6 +5,45 @@
 #include <cmath>
 #include <string>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <sstream>
+#include <new>
+#include <stdexcept>
+
+// SIMD intrinsics are only available when compiling for x86 processors
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// POSIX headers used for low-level file input/output and memory mapping
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+
+// Linux headers used to read hardware performance counters
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Type-sorted batches for static dispatch over mixed collections
+#include "staticDispatch.h"
+
+/* Buffered terminal output. asyncOut() is used EXACTLY like std::cout,
+ * but std::endl does not force a system call for every line.
+ */
+#include "asyncOutput.h"
 
 /* THE "this" POINTER:
  * ===================
@@ -43,19 +82,19 @@ public :
      * referring to the this pointer, the method arguments SHADOW the 
      * instance's member data.
      */
-    std::cout << "Arguments:\n"
-	      << "intVar => " << intVar << "\n"  
-	      << "doubleVar => " << doubleVar << "\n\n"
-	      << "Member Data:\n"
-	      << "this->intVar => " << this->intVar << "\n"  
-	      << "this->doubleVar => " << this->doubleVar
-	      << std::endl;
+    asyncOut() << "Arguments:\n"
+	       << "intVar => " << intVar << "\n"  
+	       << "doubleVar => " << doubleVar << "\n\n"
+	       << "Member Data:\n"
+	       << "this->intVar => " << this->intVar << "\n"  
+	       << "this->doubleVar => " << this->doubleVar
+	       << std::endl;
   }
   
 };
 
 void usingThisDemo(){ // Invoke with option 0.
-  std::cout << "usingThisDemo():\n" << std::endl;
+  asyncOut() << "usingThisDemo():\n" << std::endl;
   
   /* Declare and default-initialize an instance of the UsingTheThisPointer
    * class.
@@ -88,7 +127,7 @@ class MinimalCompleteClass{
 };
 
 void minimalClassDemo(){ // Invoke with option 1.
-  std::cout << "minimalClassDemo():\n" << std::endl;
+  asyncOut() << "minimalClassDemo():\n" << std::endl;
 
   /* Legal DECLARATION of a variable with the MinimalCompleteClass type-
    * specifier. Recall, this statement calls the DEFAULT CONSTRUCTOR.
@@ -111,7 +150,7 @@ void minimalClassDemo(){ // Invoke with option 1.
    * CONSTRUCTOR-STYLE initialization syntax for BUILT-IN types e.g.
    */
   int intVar(42);
-  std::cout << "inVar => " << intVar << std::endl;
+  asyncOut() << "inVar => " << intVar << std::endl;
 
 } // end of minimalClassDemo()
 
@@ -135,7 +174,7 @@ public :
 };
 
 void constructorClassDemo(){ // Invoke with option 2.
-  std::cout << "constructorClassDemo():\n" << std::endl;
+  asyncOut() << "constructorClassDemo():\n" << std::endl;
 
   /* Legal DECLARATION and CONSTRUCTOR-STYLE initialization of a variable 
    * with the ClassWithConstructor type-specifier.
@@ -158,21 +197,21 @@ void constructorClassDemo(){ // Invoke with option 2.
   double approximatePi;
 
   // Print post-DECLARATION value
-  std::cout << approximatePi << std::endl;
+  asyncOut() << approximatePi << std::endl;
  
   // Initialize approximatePi using the ASSIGNMENT OPERATOR
   approximatePi = 3.14;
 
   // Print post-INITIALIZATION value
-  std::cout << approximatePi << std::endl;
+  asyncOut() << approximatePi << std::endl;
   
   /* IDENTICAL SYNTAX is also LEGAL for USER-DEFINED types.
    */
   // Print post-DECLARATION member data values
-  std::cout << constructorClassVar.intMember1
-	    << "\t" 
-	    << constructorClassVar.intMember2
-	    << std::endl;
+  asyncOut() << constructorClassVar.intMember1
+	     << "\t" 
+	     << constructorClassVar.intMember2
+	     << std::endl;
 
   /* EXPLICITLY initialize constructorClassVar using the ASSIGNMENT
    * OPERATOR.
@@ -180,10 +219,10 @@ void constructorClassDemo(){ // Invoke with option 2.
   constructorClassVar = constructorClassConst;
 
   // Print post-INITIALIZATION member data values
-  std::cout << constructorClassVar.intMember1
-	    << "\t" 
-	    << constructorClassVar.intMember2
-	    << std::endl;
+  asyncOut() << constructorClassVar.intMember1
+	     << "\t" 
+	     << constructorClassVar.intMember2
+	     << std::endl;
   
   /* HOWEVER, for USER-DEFINED types it is NOT ALWAYS OBVIOUS what 
    * the outcome of such a statement should be.
@@ -207,7 +246,7 @@ void constructorClassDemo(){ // Invoke with option 2.
  */
 
 void stringConcatDemo(){ // Invoke with option 3.
-  std::cout << "stringConcatDemo():\n" << std::endl;
+  asyncOut() << "stringConcatDemo():\n" << std::endl;
   
   // Declare and initialize two instances of std::string
   std::string leftHandSide("Computational ");
@@ -216,10 +255,10 @@ void stringConcatDemo(){ // Invoke with option 3.
   // Concatenate two strings using the OVERLOADED "+" operator
   std::string bothSides = leftHandSide + rightHandSide;
 
-  std::cout << "Left => " << leftHandSide << "\n"
-	    << "Right => " << rightHandSide << "\n"
-	    << "Both => " << bothSides
-	    << std::endl;
+  asyncOut() << "Left => " << leftHandSide << "\n"
+	     << "Right => " << rightHandSide << "\n"
+	     << "Both => " << bothSides
+	     << std::endl;
   
 } // end of stringConcatDemo()
 
@@ -317,7 +356,7 @@ class ClassWithAssignmentOperator{
       /* Print a line to show that the copy constructor was actually
        * called!
        */
-      std::cout << "ClassWithAssignmentOperator copying..." << std::endl;
+      asyncOut() << "ClassWithAssignmentOperator copying..." << std::endl;
 
     /* (Re-)Initialize arraySize to match the corresponding member of
      * "otherInstance"
@@ -375,7 +414,7 @@ class ClassWithAssignmentOperator{
 
 void assignmentOperatorOverloadDemo(){ // Invoke with option 3.
 
-  std::cout << "assignmentOperatorOverloadDemo():\n" << std::endl;
+  asyncOut() << "assignmentOperatorOverloadDemo():\n" << std::endl;
   
   // Declare and initialize two arrays of double precision values.
   double doubleArray1[5] = {1.0, 2.0, 3.0, 4.0, 5.0};
@@ -390,18 +429,18 @@ void assignmentOperatorOverloadDemo(){ // Invoke with option 3.
   int memberArraySize1(0);
   double * memberDoubleArray1 = assignableClassVar1.getDoubleArray(memberArraySize1);
   for(int index = 0; index < memberArraySize1; index++){
-    std::cout << memberDoubleArray1[index] << " ";
+    asyncOut() << memberDoubleArray1[index] << " ";
   }
-  std::cout << std::endl;
+  asyncOut() << std::endl;
   
   // Second instance
   int memberArraySize2(0);
   double * memberDoubleArray2 = assignableClassVar2.getDoubleArray(memberArraySize2);
 
   for(int index = 0; index < memberArraySize2; index++){
-    std::cout << memberDoubleArray2[index] << " ";
+    asyncOut() << memberDoubleArray2[index] << " ";
   }
-  std::cout << std::endl;
+  asyncOut() << std::endl;
 
   /* Use the ASSIGNMENT OPERATOR to reset copyConstructorClassVar1's
    * member data to match those of copyConstructorClassVar2.
@@ -413,17 +452,17 @@ void assignmentOperatorOverloadDemo(){ // Invoke with option 3.
   // QUESTION: Why don't we delete memberDoubleArray1 first? 
   memberDoubleArray1 = assignableClassVar1.getDoubleArray(memberArraySize1);
   for(int index = 0; index < memberArraySize1; index++){
-    std::cout << memberDoubleArray1[index] << " ";
+    asyncOut() << memberDoubleArray1[index] << " ";
   }
-  std::cout << std::endl;
+  asyncOut() << std::endl;
   
   // Second instance
   memberDoubleArray2 = assignableClassVar2.getDoubleArray(memberArraySize2);
 
   for(int index = 0; index < memberArraySize2; index++){
-    std::cout << memberDoubleArray2[index] << " ";
+    asyncOut() << memberDoubleArray2[index] << " ";
   }
-  std::cout << std::endl;
+  asyncOut() << std::endl;
   
 } // end of assignmentOperatorOverloadDemo()
 
@@ -470,8 +509,12 @@ void assignmentOperatorOverloadDemo(){ // Invoke with option 3.
  */
 class PrinterClass{
 
-  // Boolean member datum to monitor the device power status.
-  bool powerIsOn;
+  /* Boolean member datum to monitor the device power status.
+   * NOTE: The "= false" DEFAULT MEMBER INITIALIZER (C++11) is used by
+   *       the compiler-generated default constructor, so every device
+   *       starts switched off rather than in an UNDEFINED state.
+   */
+  bool powerIsOn = false;
   
 public :
 
@@ -482,8 +525,8 @@ public :
    * electronic devices.  
    */
   void powerSwitch(){
-    std::cout << "PrinterClass::powerOn(): Switching: "
-	      << (powerIsOn ? "Off" : "On" ) << std::endl;
+    asyncOut() << "PrinterClass::powerOn(): Switching: "
+	       << (powerIsOn ? "Off" : "On" ) << std::endl;
 
     // toggle power status
     powerIsOn = !powerIsOn;
@@ -493,7 +536,14 @@ public :
    * that are able to print.  
    */
   void print(){
-    std::cout << "PrinterClass::print()" << std::endl;
+    asyncOut() << "PrinterClass::print()" << std::endl;
+  }
+
+  /* An OVERLOAD of print() that APPENDS the same message to a string
+   * instead of writing it to the terminal.
+   */
+  void print(std::string & output){
+    output += "PrinterClass::print()\n";
   }
   
 };
@@ -517,7 +567,7 @@ public :
   /* A specialized copy() method that only applies to photocopiers.
   */
   void copy(){
-      std::cout << "PhotoCopierClass::copy()" << std::endl;
+      asyncOut() << "PhotoCopierClass::copy()" << std::endl;
   }
   
 };
@@ -534,21 +584,28 @@ public :
    * implementation.
    */
   void print(){
-    std::cout << "ColourPrinterClass::print()" << std::endl;
+    asyncOut() << "ColourPrinterClass::print()" << std::endl;
+  }
+
+  /* NOTE: Overriding ONE overload of print() HIDES ALL of the print()
+   * overloads of PrinterClass, so this one must be overridden too.
+   */
+  void print(std::string & output){
+    output += "ColourPrinterClass::print()\n";
   }
 
   /* A more specialized printColour() method that only applies to
   * colour printers.
   */
   void printColour(){
-    std::cout << "ColourPrinterClass::printColour()" << std::endl;
+    asyncOut() << "ColourPrinterClass::printColour()" << std::endl;
   }
   
 };
 
 void inheritenceDemo(){ // Invoke with option 5. 
 
-  std::cout << "inheritenceDemo():\n" << std::endl;
+  asyncOut() << "inheritenceDemo():\n" << std::endl;
   
   // Instantiate Printer, PhotoCopier and ColorPrinter objects
   PrinterClass printer;
@@ -556,33 +613,33 @@ void inheritenceDemo(){ // Invoke with option 5.
   ColourPrinterClass colourPrinter;
 
   // Switch on the devices! Calls the generic method in all cases.
-  std::cout << "Printer => ";
+  asyncOut() << "Printer => ";
   printer.powerSwitch();
-  std::cout << "Photocopier => ";
+  asyncOut() << "Photocopier => ";
   photoCopier.powerSwitch();
-  std::cout << "ColourPrinter => ";
+  asyncOut() << "ColourPrinter => ";
   colourPrinter.powerSwitch();
 
   // Call the print method for all three devices
-  std::cout << "\nPrinter => ";
+  asyncOut() << "\nPrinter => ";
   printer.print();
-  std::cout << "Photocopier => ";
+  asyncOut() << "Photocopier => ";
   photoCopier.print(); // uses generic method provided by PrinterClass
-  std::cout << "ColourPrinter => ";
+  asyncOut() << "ColourPrinter => ";
   colourPrinter.print(); // uses the method provided by ColourPrinterClass
 
   // Call the device-specific methods where appropriate
-  std::cout << "\nPhotocopier => ";
+  asyncOut() << "\nPhotocopier => ";
   photoCopier.copy();
-  std::cout << "ColourPrinter => ";
+  asyncOut() << "ColourPrinter => ";
   colourPrinter.printColour();
 
   // Switch off the devices
-  std::cout << "\nPrinter => ";
+  asyncOut() << "\nPrinter => ";
   printer.powerSwitch();
-  std::cout << "Photocopier => ";
+  asyncOut() << "Photocopier => ";
   photoCopier.powerSwitch();
-  std::cout << "ColourPrinter => ";
+  asyncOut() << "ColourPrinter => ";
   colourPrinter.powerSwitch();
   
 }
@@ -680,11 +737,11 @@ public :
     charge(charge)
   {
     // Check that MassiveParticle component has ALREADY been initialized.
-    std::cout << "\nParameterized:\n\n"
-	      << "ChargedMassiveParticle: name => " << getName() << "\n"
-	      << "ChargedMassiveParticle: mass => " << getMass() << " kg\n"
-	      << "ChargedMassiveParticle: charge => " << getCharge() << " C"
-	      << std::endl;
+    asyncOut() << "\nParameterized:\n\n"
+	       << "ChargedMassiveParticle: name => " << getName() << "\n"
+	       << "ChargedMassiveParticle: mass => " << getMass() << " kg\n"
+	       << "ChargedMassiveParticle: charge => " << getCharge() << " C"
+	       << std::endl;
   }
 
   /* Default constructor will automatically initialize the base class using
@@ -695,11 +752,11 @@ public :
   ChargedMassiveParticle()
   {
     // Print default initialization state.
-    std::cout << "\nDefault:\n\n"
-	      << "ChargedMassiveParticle: name => " << getName() << "\n"
-	      << "ChargedMassiveParticle: mass => " << getMass() << " kg\n"
-	      << "ChargedMassiveParticle: charge => " << getCharge() << " C"
-	      << std::endl;
+    asyncOut() << "\nDefault:\n\n"
+	       << "ChargedMassiveParticle: name => " << getName() << "\n"
+	       << "ChargedMassiveParticle: mass => " << getMass() << " kg\n"
+	       << "ChargedMassiveParticle: charge => " << getCharge() << " C"
+	       << std::endl;
   }
   
   // Getter method for the particle charge
@@ -710,7 +767,7 @@ public :
 };
 
 void baseInitDemo(){ // Invoke with option 6.
-  std::cout << "baseInitDemo():\n" << std::endl;
+  asyncOut() << "baseInitDemo():\n" << std::endl;
 
   // IMPLICITLY invoke DEFAULT CONSTRUCTORS.
   ChargedMassiveParticle darkMatter;
@@ -719,46 +776,2074 @@ void baseInitDemo(){ // Invoke with option 6.
   ChargedMassiveParticle electron("electron", 9.1e-31, -1.6e-19);
 }
 
+/* BINARY SNAPSHOTS:
+ * =================
+ * The default constructor of MassiveParticle exists so that particles
+ * can be SERIALIZED and later DESERIALIZED. Writing a large particle 
+ * collection as text through iostreams is slow and bulky, so here we
+ * define a compact BINARY SNAPSHOT format instead.
+ *
+ * The format is COLUMN-ORIENTED: rather than writing each particle as
+ * a (name, mass) record, all of the masses are stored contiguously in
+ * one column and all of the names in another. Since many particles
+ * share the same name, each distinct name is stored ONCE in a NAME 
+ * TABLE and the name column only holds a 32-bit index into that table.
+ *
+ * Snapshot file layout (native byte order, all sections 8-byte aligned):
+ *
+ *   SnapshotHeader
+ *   name offsets      : std::uint64_t[nameCount + 1]
+ *   name characters   : char[nameBytes]
+ *   name index column : std::uint32_t[particleCount]
+ *   mass column       : double[particleCount]
+ *
+ * Because every section offset is known before any particle is written,
+ * several threads can write DISJOINT CHUNKS of the columns in parallel
+ * using pwrite(). Because the columns are stored exactly as they are 
+ * laid out in memory, a snapshot can be loaded by mapping the file into
+ * memory with mmap() and reading the columns IN PLACE (zero-copy).
+ */
+struct SnapshotHeader {
+  char magic[8];                 // Always "PSNAPSHT"
+  std::uint32_t version;         // Incremented if the layout changes
+  std::uint32_t byteOrderMark;   // Detects files written on other platforms
+  std::uint64_t particleCount;
+  std::uint64_t nameCount;
+  std::uint64_t nameBytes;
+  std::uint64_t nameOffsetsOffset;
+  std::uint64_t nameIndexOffset;
+  std::uint64_t massOffset;
+  std::uint64_t fileSize;
+};
+
+const char snapshotMagic[8] = {'P', 'S', 'N', 'A', 'P', 'S', 'H', 'T'};
+const std::uint32_t snapshotVersion = 1;
+const std::uint32_t snapshotByteOrderMark = 0x01020304;
+
+// Round an offset up to the next multiple of 8 bytes.
+std::uint64_t alignSnapshotOffset(std::uint64_t offset){
+  return (offset + 7) & ~std::uint64_t(7);
+}
+
+// Write an entire buffer at a given file offset, retrying short writes.
+bool pwriteFully(int fileDescriptor, const void * buffer, std::size_t size, std::uint64_t offset){
+  const char * bytes = static_cast<const char *>(buffer);
+  while(size > 0){
+    ssize_t written = ::pwrite(fileDescriptor, bytes, size, offset);
+    if(written <= 0){
+      return false;
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+/* Write a snapshot of the supplied particles to a file. The particles
+ * are divided into one contiguous chunk per thread and each thread 
+ * writes its own chunk of both columns. Returns false on failure.
+ */
+bool writeParticleSnapshot(const std::string & fileName, 
+			   std::vector<MassiveParticle> & particles,
+			   unsigned int threadCount){
 
-// main function that calls all demonstration functions
-int main (int argc, char * argv[]){
+  if(threadCount == 0){
+    threadCount = 1;
+  }
+  const std::size_t particleCount = particles.size();
+  const std::size_t chunkSize = (particleCount + threadCount - 1) / threadCount;
 
-  /* Use the std::atoi method defined in <cstdlib> to convert character
-   * arrays to integer values if possible.
+  /* PASS 1: Each thread collects the DISTINCT names in its chunk. These
+   * are merged into a single name table that is sorted so that the same
+   * particles always produce the same file.
    */
-  int option = std::atoi(argv[1]);
-  // Call requested demonstration function
-  switch (option){
-  case 0:
-    usingThisDemo();
-    break;
-    
-  case 1:
-    minimalClassDemo();
-    break;
-    
-  case 2:
-    constructorClassDemo();
-    break;
+  std::vector<std::vector<std::string> > threadNames(threadCount);
+  std::vector<std::thread> threads;
+  for(unsigned int thread = 0; thread < threadCount; ++thread){
+    threads.push_back(std::thread([&, thread](){
+	  std::unordered_map<std::string, bool> seen;
+	  std::size_t begin = std::min(particleCount, thread * chunkSize);
+	  std::size_t end = std::min(particleCount, begin + chunkSize);
+	  for(std::size_t index = begin; index < end; ++index){
+	    std::string name = particles[index].getName();
+	    if(seen.insert(std::make_pair(name, true)).second){
+	      threadNames[thread].push_back(name);
+	    }
+	  }
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  threads.clear();
 
-  case 3:
-    stringConcatDemo();
-    break;
-    
-  case 4:
-    assignmentOperatorOverloadDemo();
-    break;
+  std::vector<std::string> nameTable;
+  for(const std::vector<std::string> & names : threadNames){
+    nameTable.insert(nameTable.end(), names.begin(), names.end());
+  }
+  std::sort(nameTable.begin(), nameTable.end());
+  nameTable.erase(std::unique(nameTable.begin(), nameTable.end()), nameTable.end());
+
+  std::unordered_map<std::string, std::uint32_t> nameIndices;
+  std::vector<std::uint64_t> nameOffsets(1, 0);
+  for(std::size_t index = 0; index < nameTable.size(); ++index){
+    nameIndices[nameTable[index]] = static_cast<std::uint32_t>(index);
+    nameOffsets.push_back(nameOffsets.back() + nameTable[index].size());
+  }
 
-  case 5:
-    inheritenceDemo();
-    break;
+  // Compute the location of every section of the file.
+  SnapshotHeader header;
+  std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+  header.version = snapshotVersion;
+  header.byteOrderMark = snapshotByteOrderMark;
+  header.particleCount = particleCount;
+  header.nameCount = nameTable.size();
+  header.nameBytes = nameOffsets.back();
+  header.nameOffsetsOffset = alignSnapshotOffset(sizeof(SnapshotHeader));
+  std::uint64_t nameCharsOffset = header.nameOffsetsOffset 
+    + nameOffsets.size() * sizeof(std::uint64_t);
+  header.nameIndexOffset = alignSnapshotOffset(nameCharsOffset + header.nameBytes);
+  header.massOffset = alignSnapshotOffset(header.nameIndexOffset 
+					  + particleCount * sizeof(std::uint32_t));
+  header.fileSize = header.massOffset + particleCount * sizeof(double);
+
+  int fileDescriptor = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fileDescriptor < 0){
+    return false;
+  }
+  // Size the file up front so that threads can write anywhere within it.
+  bool success = ::ftruncate(fileDescriptor, header.fileSize) == 0;
 
-  case 6:
-    baseInitDemo();
-    break;
-    
-  default:
-    std::cout << "Unknown Option" << std::endl;
-  }// end of switch statement
+  // Write the header and name table.
+  std::string nameChars;
+  for(const std::string & name : nameTable){
+    nameChars += name;
+  }
+  success = success
+    && pwriteFully(fileDescriptor, &header, sizeof(header), 0)
+    && pwriteFully(fileDescriptor, nameOffsets.data(), 
+		   nameOffsets.size() * sizeof(std::uint64_t), header.nameOffsetsOffset)
+    && pwriteFully(fileDescriptor, nameChars.data(), nameChars.size(), nameCharsOffset);
+
+  /* PASS 2: Each thread converts its chunk into column form using a 
+   * small staging buffer and writes it directly to its final location.
+   * NOTE: Concurrent READ-ONLY lookups in nameIndices are safe.
+   */
+  std::vector<char> threadSuccess(threadCount, 1);
+  for(unsigned int thread = 0; success && thread < threadCount; ++thread){
+    threads.push_back(std::thread([&, thread](){
+	  const std::size_t stagingSize = 1 << 16;
+	  std::vector<std::uint32_t> indexStaging;
+	  std::vector<double> massStaging;
+	  indexStaging.reserve(stagingSize);
+	  massStaging.reserve(stagingSize);
+	  std::size_t begin = std::min(particleCount, thread * chunkSize);
+	  std::size_t end = std::min(particleCount, begin + chunkSize);
+	  for(std::size_t stagingBegin = begin; stagingBegin < end; stagingBegin += stagingSize){
+	    std::size_t stagingEnd = std::min(end, stagingBegin + stagingSize);
+	    indexStaging.clear();
+	    massStaging.clear();
+	    for(std::size_t index = stagingBegin; index < stagingEnd; ++index){
+	      indexStaging.push_back(nameIndices.find(particles[index].getName())->second);
+	      massStaging.push_back(particles[index].getMass());
+	    }
+	    if(!pwriteFully(fileDescriptor, indexStaging.data(),
+			    indexStaging.size() * sizeof(std::uint32_t),
+			    header.nameIndexOffset + stagingBegin * sizeof(std::uint32_t))
+	       || !pwriteFully(fileDescriptor, massStaging.data(),
+			       massStaging.size() * sizeof(double),
+			       header.massOffset + stagingBegin * sizeof(double))){
+	      threadSuccess[thread] = 0;
+	      return;
+	    }
+	  }
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  for(char threadSucceeded : threadSuccess){
+    success = success && threadSucceeded;
+  }
+  
+  return (::close(fileDescriptor) == 0) && success;
+}
+
+/* A READ-ONLY view of a snapshot file that has been mapped into memory.
+ * The columns are accessed IN PLACE, without copying. Opening a snapshot
+ * only checks the header and that each section lies inside the file, so
+ * it takes the same time for any number of particles. Each name index and
+ * name offset is checked when a name is looked up.
+ */
+class ParticleSnapshotView {
+
+  void * mapping;
+  std::size_t mappingSize;
+  const SnapshotHeader * header;
+  const std::uint64_t * nameOffsets;
+  const char * nameChars;
+  const std::uint32_t * nameIndices;
+  const double * masses;
+
+  /* Check that a section of "count" elements starts at an 8-byte aligned
+   * offset no earlier than "sectionStart", and ends inside the mapping.
+   * On success "sectionStart" is advanced to the end of the section.
+   * NOTE: The sizes are compared by division, which cannot overflow.
+   */
+  bool claimSection(std::uint64_t offset, std::uint64_t count, std::size_t elementSize,
+		    std::uint64_t & sectionStart) const {
+    if(offset % 8 != 0 || offset < sectionStart || offset > mappingSize
+       || count > (mappingSize - offset) / elementSize){
+      return false;
+    }
+    sectionStart = offset + count * elementSize;
+    return true;
+  }
+
+  // Check that every section lies inside the mapping, in order.
+  bool sectionsAreValid(const SnapshotHeader * candidate) const {
+    const char * base = static_cast<const char *>(mapping);
+    std::uint64_t sectionStart = sizeof(SnapshotHeader);
+    if(candidate->nameCount >= mappingSize
+       || !claimSection(candidate->nameOffsetsOffset, candidate->nameCount + 1,
+			sizeof(std::uint64_t), sectionStart)){
+      return false;
+    }
+    // The name characters immediately follow the name offsets.
+    std::uint64_t nameCharsOffset = sectionStart;
+    if(candidate->nameBytes > mappingSize - nameCharsOffset){
+      return false;
+    }
+    sectionStart += candidate->nameBytes;
+    if(!claimSection(candidate->nameIndexOffset, candidate->particleCount,
+		     sizeof(std::uint32_t), sectionStart)
+       || !claimSection(candidate->massOffset, candidate->particleCount,
+			sizeof(double), sectionStart)){
+      return false;
+    }
+    const std::uint64_t * offsets = 
+      reinterpret_cast<const std::uint64_t *>(base + candidate->nameOffsetsOffset);
+    return offsets[0] == 0 && offsets[candidate->nameCount] == candidate->nameBytes;
+  }
+
+public :
+
+  // Map the named file. Use isValid() to check for success.
+  explicit ParticleSnapshotView(const std::string & fileName):
+    mapping(nullptr),
+    mappingSize(0),
+    header(nullptr),
+    nameOffsets(nullptr),
+    nameChars(nullptr),
+    nameIndices(nullptr),
+    masses(nullptr)
+  {
+    int fileDescriptor = ::open(fileName.c_str(), O_RDONLY);
+    if(fileDescriptor < 0){
+      return;
+    }
+    struct stat fileStatus;
+    if(::fstat(fileDescriptor, &fileStatus) == 0 
+       && fileStatus.st_size >= static_cast<off_t>(sizeof(SnapshotHeader))){
+      mappingSize = fileStatus.st_size;
+      mapping = ::mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+      if(mapping == MAP_FAILED){
+	mapping = nullptr;
+      }
+    }
+    // The mapping remains valid after the file is closed.
+    ::close(fileDescriptor);
+    if(mapping == nullptr){
+      return;
+    }
+
+    /* Reject files with the wrong magic, version, byte order or size, and
+     * truncated or corrupt files whose sections do not fit.
+     */
+    const SnapshotHeader * candidate = static_cast<const SnapshotHeader *>(mapping);
+    const char * base = static_cast<const char *>(mapping);
+    if(std::memcmp(candidate->magic, snapshotMagic, sizeof(snapshotMagic)) != 0
+       || candidate->version != snapshotVersion
+       || candidate->byteOrderMark != snapshotByteOrderMark
+       || candidate->fileSize != mappingSize
+       || !sectionsAreValid(candidate)){
+      return;
+    }
+    header = candidate;
+    nameOffsets = reinterpret_cast<const std::uint64_t *>(base + header->nameOffsetsOffset);
+    nameChars = reinterpret_cast<const char *>(nameOffsets + header->nameCount + 1);
+    nameIndices = reinterpret_cast<const std::uint32_t *>(base + header->nameIndexOffset);
+    masses = reinterpret_cast<const double *>(base + header->massOffset);
+  }
+
+  // Mappings must not be copied, since both copies would unmap the file.
+  ParticleSnapshotView(const ParticleSnapshotView &) = delete;
+  ParticleSnapshotView & operator=(const ParticleSnapshotView &) = delete;
+
+  ~ParticleSnapshotView()
+  {
+    if(mapping != nullptr){
+      ::munmap(mapping, mappingSize);
+    }
+  }
+
+  bool isValid() const {
+    return header != nullptr;
+  }
+
+  std::size_t size() const {
+    return isValid() ? header->particleCount : 0;
+  }
+
+  std::uint32_t getVersion() const {
+    return header->version;
+  }
+
+  std::size_t getNameCount() const {
+    return header->nameCount;
+  }
+
+  /* Name of the particle with a given index. Throws std::runtime_error if
+   * the name index or name offsets of a corrupt file point outside the
+   * name table.
+   */
+  std::string getName(std::size_t index) const {
+    std::uint32_t nameIndex = nameIndices[index];
+    if(nameIndex >= header->nameCount){
+      throw std::runtime_error("Snapshot name index out of range");
+    }
+    std::uint64_t begin = nameOffsets[nameIndex];
+    std::uint64_t end = nameOffsets[nameIndex + 1];
+    if(begin > end || end > header->nameBytes){
+      throw std::runtime_error("Snapshot name offsets out of range");
+    }
+    return std::string(nameChars + begin, end - begin);
+  }
+
+  // Zero-copy access to the mass column.
+  const double * getMasses() const {
+    return masses;
+  }
+
+  /* Zero-copy access to the name index column. The indices are not
+   * checked against getNameCount().
+   */
+  const std::uint32_t * getNameIndices() const {
+    return nameIndices;
+  }
+
+  // Reconstruct a full MassiveParticle instance.
+  MassiveParticle getParticle(std::size_t index) const {
+    return MassiveParticle(getName(index), masses[index]);
+  }
+
+};
+
+void snapshotDemo(){ // Invoke with option 7.
+  asyncOut() << "snapshotDemo():\n" << std::endl;
+
+  const std::size_t particleCount = 1000000;
+  const std::string fileName("particleSnapshot.bin");
+  
+  // Build a large collection using a handful of distinct particle types.
+  const std::string names[4] = {"electron", "muon", "proton", "neutron"};
+  const double masses[4] = {9.109e-31, 1.884e-28, 1.673e-27, 1.675e-27};
+  std::vector<MassiveParticle> particles;
+  particles.reserve(particleCount);
+  for(std::size_t index = 0; index < particleCount; ++index){
+    particles.push_back(MassiveParticle(names[index % 4], masses[index % 4]));
+  }
+
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+  if(!writeParticleSnapshot(fileName, particles, threadCount)){
+    asyncOut() << "Failed to write " << fileName << std::endl;
+    return;
+  }
+  std::chrono::duration<double> writeTime = std::chrono::steady_clock::now() - writeStart;
+
+  std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+  ParticleSnapshotView snapshot(fileName);
+  if(!snapshot.isValid()){
+    asyncOut() << "Failed to load " << fileName << std::endl;
+    return;
+  }
+  // Touch every mass so that the timing includes reading the data.
+  double totalMass(0.0);
+  const double * snapshotMasses = snapshot.getMasses();
+  for(std::size_t index = 0; index < snapshot.size(); ++index){
+    totalMass += snapshotMasses[index];
+  }
+  std::chrono::duration<double> loadTime = std::chrono::steady_clock::now() - loadStart;
+
+  asyncOut() << "Wrote " << particleCount << " particles using " << threadCount 
+	     << " thread(s) in " << writeTime.count() << " s\n"
+	     << "Loaded version " << snapshot.getVersion() << " snapshot with "
+	     << snapshot.size() << " particles and " << snapshot.getNameCount()
+	     << " distinct names in " << loadTime.count() << " s\n"
+	     << "Total mass => " << totalMass << " kg\n";
+  for(std::size_t index = 0; index < 4; ++index){
+    MassiveParticle particle = snapshot.getParticle(index);
+    asyncOut() << "Particle " << index << ": name => " << particle.getName()
+	       << ", mass => " << particle.getMass() << " kg\n";
+  }
+  asyncOut() << std::endl;
+}
+
+/* A FLEET OF PRINTERS:
+ * ====================
+ * The PrinterClass hierarchy describes INDIVIDUAL devices whose methods
+ * are called SYNCHRONOUSLY. A fleet of devices is better modelled as a
+ * set of WORKERS that consume JOBS submitted by any number of PRODUCERS.
+ *
+ * Jobs are passed through a BOUNDED, LOCK-FREE, MULTI-PRODUCER MULTI-
+ * CONSUMER (MPMC) queue. Each slot (Cell) of a fixed-size ring buffer 
+ * carries a SEQUENCE NUMBER that tells producers when the slot is free 
+ * and consumers when it holds a value, so pushing and popping only 
+ * require an atomic compare-and-swap on the queue position and never
+ * block on a mutex.
+ */
+template<typename T>
+class BoundedMPMCQueue {
+
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  std::size_t mask;
+  // Padding keeps producers and consumers from sharing a cache line.
+  char padding0[64];
+  std::atomic<std::size_t> enqueuePosition;
+  char padding1[64];
+  std::atomic<std::size_t> dequeuePosition;
+  char padding2[64];
+
+public :
+
+  // Capacity is rounded up to a power of two.
+  explicit BoundedMPMCQueue(std::size_t capacity):
+    mask(0),
+    enqueuePosition(0),
+    dequeuePosition(0)
+  {
+    std::size_t size = 2;
+    while(size < capacity){
+      size *= 2;
+    }
+    cells.reset(new Cell[size]);
+    mask = size - 1;
+    for(std::size_t index = 0; index < size; ++index){
+      cells[index].sequence.store(index, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedMPMCQueue(const BoundedMPMCQueue &) = delete;
+  BoundedMPMCQueue & operator=(const BoundedMPMCQueue &) = delete;
+
+  // Returns false if the queue is full.
+  bool tryPush(const T & value){
+    std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    for(;;){
+      Cell & cell = cells[position & mask];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) 
+	- static_cast<std::ptrdiff_t>(position);
+      if(difference == 0){
+	if(enqueuePosition.compare_exchange_weak(position, position + 1, 
+						 std::memory_order_relaxed)){
+	  cell.value = value;
+	  cell.sequence.store(position + 1, std::memory_order_release);
+	  return true;
+	}
+      }
+      else if(difference < 0){
+	return false;
+      }
+      else{
+	position = enqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false if the queue is empty.
+  bool tryPop(T & value){
+    std::size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    for(;;){
+      Cell & cell = cells[position & mask];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) 
+	- static_cast<std::ptrdiff_t>(position + 1);
+      if(difference == 0){
+	if(dequeuePosition.compare_exchange_weak(position, position + 1, 
+						 std::memory_order_relaxed)){
+	  value = cell.value;
+	  cell.sequence.store(position + mask + 1, std::memory_order_release);
+	  return true;
+	}
+      }
+      else if(difference < 0){
+	return false;
+      }
+      else{
+	position = dequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+};
+
+// The kinds of job a device may be able to perform.
+enum DeviceJobType { PRINT_JOB = 0, COPY_JOB = 1, COLOUR_JOB = 2 };
+
+struct DeviceJob {
+  DeviceJobType type;
+  int pages;
+  std::chrono::steady_clock::time_point submitted;
+};
+
+/* Bit mask of the job types each device class can perform. Derived 
+ * classes add to the capabilities INHERITED from PrinterClass.
+ */
+template<typename Device> unsigned int deviceCapabilities();
+template<> unsigned int deviceCapabilities<PrinterClass>(){ 
+  return 1u << PRINT_JOB; 
+}
+template<> unsigned int deviceCapabilities<PhotoCopierClass>(){ 
+  return (1u << PRINT_JOB) | (1u << COPY_JOB); 
+}
+template<> unsigned int deviceCapabilities<ColourPrinterClass>(){ 
+  return (1u << PRINT_JOB) | (1u << COLOUR_JOB); 
+}
+
+/* One worker in the fleet: a job queue plus the statistics gathered by
+ * the thread that serves it.
+ */
+struct FleetWorker {
+  std::string name;
+  unsigned int capabilities;
+  BoundedMPMCQueue<DeviceJob> queue;
+  std::vector<double> latencies; // Queue latency of each job (microseconds)
+  std::size_t stolenJobs;
+
+  FleetWorker(const std::string & name, unsigned int capabilities, std::size_t capacity):
+    name(name),
+    capabilities(capabilities),
+    queue(capacity),
+    stolenJobs(0)
+  {}
+};
+
+// Simulate the time a device spends on each page of a job.
+double processJob(const DeviceJob & job){
+  double ink(0.0);
+  for(int page = 0; page < job.pages * 100; ++page){
+    ink += std::sqrt(static_cast<double>(page));
+  }
+  return ink;
+}
+
+// Percentile of an ALREADY SORTED vector of values.
+double sortedPercentile(const std::vector<double> & sortedValues, double percentile){
+  if(sortedValues.empty()){
+    return 0.0;
+  }
+  std::size_t rank = static_cast<std::size_t>(percentile / 100.0 * (sortedValues.size() - 1) + 0.5);
+  return sortedValues[rank];
+}
+
+/* Serve jobs from the worker's own queue. When it is empty, STEAL work
+ * from the queue of another worker, but only from a worker whose 
+ * capabilities are a SUBSET of this worker's, so that every stolen job 
+ * can be performed.
+ */
+void runFleetWorker(std::vector<std::unique_ptr<FleetWorker> > & workers, std::size_t self,
+		    std::atomic<std::size_t> & jobsRemaining, std::atomic<double> & inkUsed){
+  FleetWorker & worker = *workers[self];
+  double ink(0.0);
+  DeviceJob job;
+  while(jobsRemaining.load(std::memory_order_acquire) > 0){
+    bool haveJob = worker.queue.tryPop(job);
+    for(std::size_t offset = 1; !haveJob && offset < workers.size(); ++offset){
+      FleetWorker & victim = *workers[(self + offset) % workers.size()];
+      if((victim.capabilities & ~worker.capabilities) == 0 && victim.queue.tryPop(job)){
+	haveJob = true;
+	++worker.stolenJobs;
+      }
+    }
+    if(!haveJob){
+      std::this_thread::yield();
+      continue;
+    }
+    std::chrono::duration<double, std::micro> latency = 
+      std::chrono::steady_clock::now() - job.submitted;
+    worker.latencies.push_back(latency.count());
+    ink += processJob(job);
+    jobsRemaining.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  // Accumulate a result so that the simulated work is not optimized away.
+  double expected = inkUsed.load();
+  while(!inkUsed.compare_exchange_weak(expected, expected + ink)){
+  }
+}
+
+/* Submit jobs to the devices able to perform them, in round-robin 
+ * order, moving on to the next capable device if a queue is full.
+ */
+void runFleetProducer(std::vector<std::unique_ptr<FleetWorker> > & workers,
+		      std::size_t jobCount, unsigned int seed){
+  std::vector<std::size_t> nextDevice(3, seed);
+  for(std::size_t jobIndex = 0; jobIndex < jobCount; ++jobIndex){
+    DeviceJob job;
+    // Roughly 60% print, 25% copy and 15% colour jobs.
+    unsigned int draw = (seed + jobIndex * 7919) % 20;
+    job.type = draw < 12 ? PRINT_JOB : (draw < 17 ? COPY_JOB : COLOUR_JOB);
+    job.pages = 1 + (jobIndex % 5);
+    bool submitted = false;
+    while(!submitted){
+      for(std::size_t attempt = 0; !submitted && attempt < workers.size(); ++attempt){
+	FleetWorker & worker = *workers[nextDevice[job.type]++ % workers.size()];
+	if(worker.capabilities & (1u << job.type)){
+	  job.submitted = std::chrono::steady_clock::now();
+	  submitted = worker.queue.tryPush(job);
+	}
+      }
+      if(!submitted){
+	std::this_thread::yield();
+      }
+    }
+  }
+}
+
+void printerFleetDemo(){ // Invoke with option 8.
+  asyncOut() << "printerFleetDemo():\n" << std::endl;
+
+  const std::size_t jobCount = 200000;
+  const std::size_t producerCount = 2;
+  const std::size_t queueCapacity = 1024;
+
+  // The devices in the fleet.
+  PrinterClass printer1, printer2;
+  PhotoCopierClass photoCopier;
+  ColourPrinterClass colourPrinter;
+  
+  std::vector<std::unique_ptr<FleetWorker> > workers;
+  workers.push_back(std::unique_ptr<FleetWorker>(
+    new FleetWorker("Printer 1", deviceCapabilities<PrinterClass>(), queueCapacity)));
+  workers.push_back(std::unique_ptr<FleetWorker>(
+    new FleetWorker("Printer 2", deviceCapabilities<PrinterClass>(), queueCapacity)));
+  workers.push_back(std::unique_ptr<FleetWorker>(
+    new FleetWorker("Photocopier", deviceCapabilities<PhotoCopierClass>(), queueCapacity)));
+  workers.push_back(std::unique_ptr<FleetWorker>(
+    new FleetWorker("ColourPrinter", deviceCapabilities<ColourPrinterClass>(), queueCapacity)));
+  for(std::unique_ptr<FleetWorker> & worker : workers){
+    worker->latencies.reserve(jobCount);
+  }
+
+  // Switch on the devices before any jobs arrive.
+  printer1.powerSwitch();
+  printer2.powerSwitch();
+  photoCopier.powerSwitch();
+  colourPrinter.powerSwitch();
+
+  std::atomic<std::size_t> jobsRemaining(jobCount);
+  std::atomic<double> inkUsed(0.0);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for(std::size_t index = 0; index < workers.size(); ++index){
+    threads.push_back(std::thread(runFleetWorker, std::ref(workers), index,
+				  std::ref(jobsRemaining), std::ref(inkUsed)));
+  }
+  for(std::size_t producer = 0; producer < producerCount; ++producer){
+    std::size_t producerJobs = jobCount / producerCount 
+      + (producer < jobCount % producerCount ? 1 : 0);
+    threads.push_back(std::thread(runFleetProducer, std::ref(workers), producerJobs,
+				  static_cast<unsigned int>(producer)));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  // Switch off the devices once every job is done.
+  printer1.powerSwitch();
+  printer2.powerSwitch();
+  photoCopier.powerSwitch();
+  colourPrinter.powerSwitch();
+
+  asyncOut() << "\n" << jobCount << " jobs from " << producerCount << " producers in "
+	     << elapsed.count() << " s (ink => " << inkUsed.load() << ")\n\n"
+	     << "Device\tJobs\tStolen\tJobs/s\tp50 us\tp90 us\tp99 us\n";
+  for(std::unique_ptr<FleetWorker> & worker : workers){
+    std::sort(worker->latencies.begin(), worker->latencies.end());
+    asyncOut() << worker->name << "\t"
+	       << worker->latencies.size() << "\t"
+	       << worker->stolenJobs << "\t"
+	       << static_cast<std::size_t>(worker->latencies.size() / elapsed.count()) << "\t"
+	       << sortedPercentile(worker->latencies, 50.0) << "\t"
+	       << sortedPercentile(worker->latencies, 90.0) << "\t"
+	       << sortedPercentile(worker->latencies, 99.0) << "\n";
+  }
+  asyncOut() << std::endl;
+}
+
+/* STATIC VERSUS DYNAMIC DISPATCH:
+ * ===============================
+ * ColourPrinterClass::print() HIDES PrinterClass::print() rather than 
+ * overriding it VIRTUALLY, so a mixed collection of devices cannot be 
+ * processed through PrinterClass pointers. The classic alternative is
+ * a hierarchy with VIRTUAL methods, like the one below. 
+ *
+ * The TypeSortedBatches class in "staticDispatch.h" instead keeps one 
+ * batch per device type, so the correct print() is chosen at COMPILE 
+ * TIME. The following demonstration compares the two approaches.
+ */
+class VirtualPrinterClass {
+
+public :
+
+  virtual ~VirtualPrinterClass()
+  {}
+
+  virtual void print(std::string & output){
+    output += "PrinterClass::print()\n";
+  }
+
+};
+
+class VirtualPhotoCopierClass : public VirtualPrinterClass {
+};
+
+class VirtualColourPrinterClass : public VirtualPrinterClass {
+
+public :
+
+  void print(std::string & output) override {
+    output += "ColourPrinterClass::print()\n";
+  }
+
+};
+
+// Function object that calls print() for any type of device.
+struct PrintInto {
+
+  std::string & output;
+  std::size_t & totalLength;
+
+  template<typename Device>
+  void operator()(Device & device){
+    device.print(output);
+    // Empty the output periodically so that it stays in the cache.
+    if(output.size() > 4096){
+      totalLength += output.size();
+      output.clear();
+    }
+  }
+
+};
+
+// Function object that records the address of any type of device.
+struct CollectAddress {
+
+  std::vector<VirtualPrinterClass *> & addresses;
+
+  template<typename Device>
+  void operator()(Device & device){
+    addresses.push_back(&device);
+  }
+
+};
+
+/* Call print() through each of a range of base class pointers (plain or
+ * smart), returning the total length of the output.
+ */
+template<typename Pointers>
+std::size_t printVirtually(Pointers & devices, std::string & output){
+  std::size_t totalLength(0);
+  for(auto & device : devices){
+    device->print(output);
+    if(output.size() > 4096){
+      totalLength += output.size();
+      output.clear();
+    }
+  }
+  totalLength += output.size();
+  output.clear();
+  return totalLength;
+}
+
+void staticDispatchDemo(){ // Invoke with option 9.
+  asyncOut() << "staticDispatchDemo():\n" << std::endl;
+
+  const std::size_t deviceCount = 10000000;
+
+  /* Build the same pseudo-random mix of devices three times: as separate
+   * allocations of virtual classes in random order, as type-sorted 
+   * batches of virtual classes, and as type-sorted batches.
+   */
+  std::vector<std::unique_ptr<VirtualPrinterClass> > virtualDevices;
+  virtualDevices.reserve(deviceCount);
+  TypeSortedBatches<VirtualPrinterClass, VirtualPhotoCopierClass, 
+		    VirtualColourPrinterClass> virtualBatches;
+  TypeSortedBatches<PrinterClass, PhotoCopierClass, ColourPrinterClass> staticDevices;
+  unsigned int state = 12345;
+  for(std::size_t index = 0; index < deviceCount; ++index){
+    state = state * 1103515245u + 12345u;
+    switch((state >> 16) % 3){
+    case 0:
+      virtualDevices.push_back(std::unique_ptr<VirtualPrinterClass>(new VirtualPrinterClass));
+      virtualBatches.add(VirtualPrinterClass());
+      staticDevices.add(PrinterClass());
+      break;
+    case 1:
+      virtualDevices.push_back(std::unique_ptr<VirtualPrinterClass>(new VirtualPhotoCopierClass));
+      virtualBatches.add(VirtualPhotoCopierClass());
+      staticDevices.add(PhotoCopierClass());
+      break;
+    default:
+      virtualDevices.push_back(std::unique_ptr<VirtualPrinterClass>(new VirtualColourPrinterClass));
+      virtualBatches.add(VirtualColourPrinterClass());
+      staticDevices.add(ColourPrinterClass());
+    }
+  }
+
+  /* Pointers to the contiguous virtual devices, in type-sorted order.
+   * Taken only once every device has been added, since adding to a batch
+   * may move its elements.
+   */
+  std::vector<VirtualPrinterClass *> sortedVirtualDevices;
+  sortedVirtualDevices.reserve(deviceCount);
+  CollectAddress collectAddress = {sortedVirtualDevices};
+  virtualBatches.forEach(collectAddress);
+
+  std::string output;
+  output.reserve(8192);
+
+  /* Dynamic dispatch: one indirect call per device. The devices are
+   * scattered in memory and their types are in random order, so this 
+   * also pays for cache misses and mispredicted calls.
+   */
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::size_t virtualLength = printVirtually(virtualDevices, output);
+  std::chrono::duration<double> virtualTime = std::chrono::steady_clock::now() - start;
+
+  /* Dynamic dispatch over contiguous devices in type-sorted order, i.e.
+   * the same memory layout and order as the static batches below. The
+   * difference between this and static dispatch is the cost of the 
+   * indirect call alone.
+   */
+  start = std::chrono::steady_clock::now();
+  std::size_t sortedVirtualLength = printVirtually(sortedVirtualDevices, output);
+  std::chrono::duration<double> sortedVirtualTime = std::chrono::steady_clock::now() - start;
+
+  // Static dispatch: the print() method is resolved at compile time.
+  std::size_t staticLength(0);
+  PrintInto printInto = {output, staticLength};
+  start = std::chrono::steady_clock::now();
+  staticDevices.forEach(printInto);
+  staticLength += output.size();
+  output.clear();
+  std::chrono::duration<double> staticTime = std::chrono::steady_clock::now() - start;
+
+  asyncOut() << deviceCount << " devices ("
+	     << staticDevices.batch<PrinterClass>().size() << " printers, "
+	     << staticDevices.batch<PhotoCopierClass>().size() << " photocopiers, "
+	     << staticDevices.batch<ColourPrinterClass>().size() << " colour printers)\n"
+	     << "Virtual dispatch, scattered => " << virtualTime.count() << " s ("
+	     << 1.0e9 * virtualTime.count() / deviceCount << " ns/device, "
+	     << virtualLength << " bytes)\n"
+	     << "Virtual dispatch, sorted    => " << sortedVirtualTime.count() << " s ("
+	     << 1.0e9 * sortedVirtualTime.count() / deviceCount << " ns/device, "
+	     << sortedVirtualLength << " bytes)\n"
+	     << "Static dispatch,  sorted    => " << staticTime.count() << " s ("
+	     << 1.0e9 * staticTime.count() / deviceCount << " ns/device, "
+	     << staticLength << " bytes)"
+	     << std::endl;
+}
+
+/* BIT-PACKED DEVICE FLEETS:
+ * =========================
+ * Each PrinterClass instance uses a whole bool (one byte) to record its
+ * power status, and devices can only be switched one at a time. For a
+ * fleet of millions of devices it is much more efficient to store the
+ * power status of 64 devices in the BITS of a single 64-bit word.
+ *
+ * This uses one eighth of the memory, and operations on the whole fleet
+ * act on 64 devices at once using BITWISE operators. These simple loops
+ * over contiguous words are also ideal candidates for the compiler to
+ * VECTORIZE using SIMD instructions.
+ *
+ * NOTE: std::vector<bool> also packs bits, but provides no access to 
+ *       the underlying words.
+ */
+class DeviceFleet {
+
+  // Bit (index % 64) of words[index / 64] is set if device index is on.
+  std::vector<std::uint64_t> words;
+  std::size_t deviceCount;
+
+  // Bits beyond the last device must stay zero so that countOn() is right.
+  void clearUnusedBits(){
+    if(deviceCount % 64 != 0){
+      words.back() &= (std::uint64_t(1) << (deviceCount % 64)) - 1;
+    }
+  }
+
+public :
+
+  /* A VIEW of one device in the fleet, which provides the same 
+   * powerSwitch() method as PrinterClass.
+   */
+  class DeviceView {
+
+    DeviceFleet & fleet;
+    std::size_t index;
+
+  public :
+
+    DeviceView(DeviceFleet & fleet, std::size_t index):
+      fleet(fleet),
+      index(index)
+    {}
+
+    bool isOn() const {
+      return fleet.isOn(index);
+    }
+
+    void powerSwitch(){
+      asyncOut() << "PrinterClass::powerOn(): Switching: "
+		 << (isOn() ? "Off" : "On" ) << std::endl;
+      fleet.toggle(index);
+    }
+
+  };
+
+  // A mask has one bit per device, stored in the same layout as the fleet.
+  typedef std::vector<std::uint64_t> Mask;
+
+  // All devices start switched off.
+  explicit DeviceFleet(std::size_t deviceCount):
+    words((deviceCount + 63) / 64, 0),
+    deviceCount(deviceCount)
+  {}
+
+  std::size_t size() const {
+    return deviceCount;
+  }
+
+  // Memory used to store the power status of the whole fleet.
+  std::size_t sizeInBytes() const {
+    return words.size() * sizeof(std::uint64_t);
+  }
+
+  DeviceView operator[](std::size_t index){
+    return DeviceView(*this, index);
+  }
+
+  bool isOn(std::size_t index) const {
+    return (words[index / 64] >> (index % 64)) & 1;
+  }
+
+  // Toggle a single device without printing anything.
+  void toggle(std::size_t index){
+    words[index / 64] ^= std::uint64_t(1) << (index % 64);
+  }
+
+  void toggleAll(){
+    for(std::size_t word = 0; word < words.size(); ++word){
+      words[word] = ~words[word];
+    }
+    clearUnusedBits();
+  }
+
+  void switchAll(bool on){
+    std::fill(words.begin(), words.end(), on ? ~std::uint64_t(0) : 0);
+    clearUnusedBits();
+  }
+
+  // An empty mask with the right number of words for this fleet.
+  Mask makeMask() const {
+    return Mask(words.size(), 0);
+  }
+
+  static void setMaskBit(Mask & mask, std::size_t index){
+    mask[index / 64] |= std::uint64_t(1) << (index % 64);
+  }
+
+  // Toggle every device whose bit is set in the mask.
+  void toggleByMask(const Mask & mask){
+    std::size_t wordCount = std::min(words.size(), mask.size());
+    for(std::size_t word = 0; word < wordCount; ++word){
+      words[word] ^= mask[word];
+    }
+    clearUnusedBits();
+  }
+
+  // Number of devices that are switched on.
+  std::size_t countOn() const {
+    std::size_t count(0);
+    for(std::uint64_t word : words){
+      count += __builtin_popcountll(word);
+    }
+    return count;
+  }
+
+};
+
+void deviceFleetDemo(){ // Invoke with option 10.
+  asyncOut() << "deviceFleetDemo():\n" << std::endl;
+
+  const std::size_t deviceCount = 10000000;
+  DeviceFleet fleet(deviceCount);
+
+  // Individual devices behave just like PrinterClass instances.
+  asyncOut() << "Device 0 => ";
+  fleet[0].powerSwitch();
+  asyncOut() << "Device 1 => ";
+  fleet[1].powerSwitch();
+  asyncOut() << "Device 0 => ";
+  fleet[0].powerSwitch();
+
+  asyncOut() << "\n" << deviceCount << " devices stored in " << fleet.sizeInBytes()
+	     << " bytes (" << deviceCount * sizeof(PrinterClass) 
+	     << " bytes as PrinterClass instances)\n"
+	     << "Switched on => " << fleet.countOn() << "\n";
+
+  // Switch on every device.
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  fleet.toggleAll();
+  std::chrono::duration<double, std::milli> toggleTime = std::chrono::steady_clock::now() - start;
+  asyncOut() << "toggleAll() => " << toggleTime.count() << " ms, switched on => " 
+	     << fleet.countOn() << "\n";
+
+  // Switch off every third device.
+  DeviceFleet::Mask everyThird = fleet.makeMask();
+  for(std::size_t index = 0; index < deviceCount; index += 3){
+    DeviceFleet::setMaskBit(everyThird, index);
+  }
+  start = std::chrono::steady_clock::now();
+  fleet.toggleByMask(everyThird);
+  toggleTime = std::chrono::steady_clock::now() - start;
+  asyncOut() << "toggleByMask() => " << toggleTime.count() << " ms, switched on => " 
+	     << fleet.countOn() << "\n";
+
+  start = std::chrono::steady_clock::now();
+  std::size_t switchedOn = fleet.countOn();
+  std::chrono::duration<double, std::milli> countTime = std::chrono::steady_clock::now() - start;
+  asyncOut() << "countOn() => " << countTime.count() << " ms, switched on => " 
+	     << switchedOn << std::endl;
+}
+
+
+/* BUILDING LARGE STRINGS:
+ * =======================
+ * stringConcatDemo() showed that "+" concatenates two std::strings. Each
+ * use of "+" creates a NEW string and COPIES both operands into it, so 
+ * building a report with
+ *
+ *   report = report + fragment;
+ *
+ * copies everything built so far for EVERY fragment. The total cost
+ * grows QUADRATICALLY with the number of fragments.
+ *
+ * A STRING BUILDER avoids this by first collecting the fragments, then
+ * computing the TOTAL length, allocating memory ONCE and copying each
+ * fragment exactly once.
+ *
+ * NOTE: The builder only stores POINTERS to the fragments, which must
+ *       therefore still exist when build() is called.
+ */
+class StringBuilder {
+
+  std::vector<std::pair<const char *, std::size_t> > fragments;
+  std::size_t totalLength;
+
+public :
+
+  StringBuilder():
+    totalLength(0)
+  {}
+
+  /* Append methods return a reference to the CURRENT INSTANCE, so that
+   * calls can be chained: builder.append(a).append(b);
+   */
+  StringBuilder & append(const char * fragment, std::size_t length){
+    fragments.push_back(std::make_pair(fragment, length));
+    totalLength += length;
+    return *this;
+  }
+
+  StringBuilder & append(const std::string & fragment){
+    return append(fragment.data(), fragment.size());
+  }
+
+  /* A TEMPORARY string would be destroyed before build() is called, so
+   * appending one is forbidden by DELETING this overload.
+   */
+  StringBuilder & append(std::string && fragment) = delete;
+
+  std::size_t length() const {
+    return totalLength;
+  }
+
+  std::string build() const {
+    std::string result;
+    result.reserve(totalLength);
+    for(const std::pair<const char *, std::size_t> & fragment : fragments){
+      result.append(fragment.first, fragment.second);
+    }
+    return result;
+  }
+
+};
+
+/* ROPES:
+ * ======
+ * Inserting into or erasing from the middle of a very large std::string
+ * must move everything that follows. A ROPE instead stores text as a 
+ * BINARY TREE whose LEAVES hold short pieces of the text, so appending,
+ * inserting and erasing only create O(log n) new nodes.
+ *
+ * Nodes are IMMUTABLE and shared using std::shared_ptr, so that copying
+ * a rope, or keeping an old version, is cheap.
+ */
+class Rope {
+
+  struct Node;
+  typedef std::shared_ptr<const Node> NodePointer;
+
+  struct Node {
+    NodePointer left;
+    NodePointer right;
+    std::string leaf;    // Only used by leaf nodes
+    std::size_t length;  // Length of all the text below this node
+    std::size_t depth;   // Zero for leaf nodes
+
+    explicit Node(const std::string & leaf):
+      leaf(leaf),
+      length(leaf.size()),
+      depth(0)
+    {}
+
+    Node(const NodePointer & left, const NodePointer & right):
+      left(left),
+      right(right),
+      length(left->length + right->length),
+      depth(1 + std::max(left->depth, right->depth))
+    {}
+  };
+
+  // Short neighbouring leaves are merged to keep the tree small.
+  static const std::size_t maximumLeafLength = 512;
+  /* concatenate() keeps the tree roughly balanced; as a safeguard the
+   * whole tree is rebuilt if it ever becomes deeper than this.
+   */
+  static const std::size_t maximumDepth = 64;
+
+  NodePointer root;
+
+  explicit Rope(const NodePointer & root):
+    root(root)
+  {}
+
+  /* Join two trees. If one is much deeper than the other, the shallower
+   * tree is joined further down the deeper one and the result ROTATED
+   * if necessary, so that depths stay close to log2(leaves), as in an 
+   * AVL tree.
+   */
+  static NodePointer concatenate(const NodePointer & left, const NodePointer & right){
+    if(!left || left->length == 0){
+      return right;
+    }
+    if(!right || right->length == 0){
+      return left;
+    }
+    if(left->depth == 0 && right->depth == 0 
+       && left->length + right->length <= maximumLeafLength){
+      return std::make_shared<const Node>(left->leaf + right->leaf);
+    }
+    if(left->depth > right->depth + 1){
+      NodePointer joined = concatenate(left->right, right);
+      if(joined->depth <= left->left->depth + 1){
+	return std::make_shared<const Node>(left->left, joined);
+      }
+      return std::make_shared<const Node>(std::make_shared<const Node>(left->left, joined->left),
+					  joined->right);
+    }
+    if(right->depth > left->depth + 1){
+      NodePointer joined = concatenate(left, right->left);
+      if(joined->depth <= right->right->depth + 1){
+	return std::make_shared<const Node>(joined, right->right);
+      }
+      return std::make_shared<const Node>(joined->left,
+					  std::make_shared<const Node>(joined->right, right->right));
+    }
+    return std::make_shared<const Node>(left, right);
+  }
+
+  // Split the text below a node into [0, position) and [position, end).
+  static std::pair<NodePointer, NodePointer> split(const NodePointer & node, std::size_t position){
+    if(!node){
+      return std::make_pair(NodePointer(), NodePointer());
+    }
+    if(position == 0){
+      return std::make_pair(NodePointer(), node);
+    }
+    if(position >= node->length){
+      return std::make_pair(node, NodePointer());
+    }
+    if(node->depth == 0){
+      return std::make_pair(std::make_shared<const Node>(node->leaf.substr(0, position)),
+			    std::make_shared<const Node>(node->leaf.substr(position)));
+    }
+    if(position < node->left->length){
+      std::pair<NodePointer, NodePointer> parts = split(node->left, position);
+      return std::make_pair(parts.first, concatenate(parts.second, node->right));
+    }
+    std::pair<NodePointer, NodePointer> parts = split(node->right, position - node->left->length);
+    return std::make_pair(concatenate(node->left, parts.first), parts.second);
+  }
+
+  static void collectLeaves(const NodePointer & node, std::vector<NodePointer> & leaves){
+    if(!node){
+      return;
+    }
+    if(node->depth == 0){
+      leaves.push_back(node);
+      return;
+    }
+    collectLeaves(node->left, leaves);
+    collectLeaves(node->right, leaves);
+  }
+
+  static NodePointer buildBalanced(const std::vector<NodePointer> & leaves, 
+				   std::size_t begin, std::size_t end){
+    if(end - begin == 1){
+      return leaves[begin];
+    }
+    std::size_t middle = begin + (end - begin) / 2;
+    return std::make_shared<const Node>(buildBalanced(leaves, begin, middle),
+					buildBalanced(leaves, middle, end));
+  }
+
+  void rebalanceIfNeeded(){
+    if(root && root->depth > maximumDepth){
+      std::vector<NodePointer> leaves;
+      collectLeaves(root, leaves);
+      root = buildBalanced(leaves, 0, leaves.size());
+    }
+  }
+
+  static void appendTo(const NodePointer & node, std::string & text){
+    if(!node){
+      return;
+    }
+    if(node->depth == 0){
+      text += node->leaf;
+      return;
+    }
+    appendTo(node->left, text);
+    appendTo(node->right, text);
+  }
+
+public :
+
+  Rope()
+  {}
+
+  explicit Rope(const std::string & text)
+  {
+    // Divide long text into leaves of at most maximumLeafLength characters.
+    std::vector<NodePointer> leaves;
+    for(std::size_t begin = 0; begin < text.size(); begin += maximumLeafLength){
+      leaves.push_back(std::make_shared<const Node>(text.substr(begin, maximumLeafLength)));
+    }
+    if(!leaves.empty()){
+      root = buildBalanced(leaves, 0, leaves.size());
+    }
+  }
+
+  std::size_t length() const {
+    return root ? root->length : 0;
+  }
+
+  /* Character at a given position, found by descending the tree. Like
+   * std::string::at(), throws std::out_of_range if there is no such
+   * position.
+   */
+  char at(std::size_t position) const {
+    if(position >= length()){
+      throw std::out_of_range("Rope::at: position " + std::to_string(position)
+			      + " is not less than length " + std::to_string(length()));
+    }
+    const Node * node = root.get();
+    while(node->depth != 0){
+      if(position < node->left->length){
+	node = node->left.get();
+      }
+      else{
+	position -= node->left->length;
+	node = node->right.get();
+      }
+    }
+    return node->leaf[position];
+  }
+
+  Rope & append(const std::string & text){
+    return append(Rope(text));
+  }
+
+  Rope & append(const Rope & other){
+    root = concatenate(root, other.root);
+    rebalanceIfNeeded();
+    return *this;
+  }
+
+  Rope & insert(std::size_t position, const std::string & text){
+    std::pair<NodePointer, NodePointer> parts = split(root, position);
+    root = concatenate(concatenate(parts.first, Rope(text).root), parts.second);
+    rebalanceIfNeeded();
+    return *this;
+  }
+
+  Rope & erase(std::size_t position, std::size_t count){
+    std::pair<NodePointer, NodePointer> head = split(root, position);
+    std::pair<NodePointer, NodePointer> tail = split(head.second, count);
+    root = concatenate(head.first, tail.second);
+    rebalanceIfNeeded();
+    return *this;
+  }
+
+  std::string toString() const {
+    std::string text;
+    text.reserve(length());
+    appendTo(root, text);
+    return text;
+  }
+
+};
+
+void stringBuilderDemo(){ // Invoke with option 11.
+  asyncOut() << "stringBuilderDemo():\n" << std::endl;
+
+  /* Ten times as many fragments take about 100 times longer with "+",
+   * so larger sizes are skipped once that would exceed this time limit.
+   */
+  const double concatTimeLimit = 1.0;
+  bool skipConcat = false;
+
+  asyncOut() << "Fragments\tBytes\toperator+ (s)\toperator+= (s)\tStringBuilder (s)\tRope (s)\n";
+  for(std::size_t fragmentCount = 1000; fragmentCount <= 1000000; fragmentCount *= 10){
+    std::vector<std::string> fragments;
+    fragments.reserve(fragmentCount);
+    for(std::size_t index = 0; index < fragmentCount; ++index){
+      fragments.push_back("Fragment " + std::to_string(index) + "\n");
+    }
+
+    // Quadratic: every "+" copies the whole report so far.
+    std::string concatReport;
+    std::chrono::duration<double> concatTime(0.0);
+    if(!skipConcat){
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(const std::string & fragment : fragments){
+	concatReport = concatReport + fragment;
+      }
+      concatTime = std::chrono::steady_clock::now() - start;
+    }
+
+    // For reference: "+=" appends in place, growing the string as needed.
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string appendReport;
+    for(const std::string & fragment : fragments){
+      appendReport += fragment;
+    }
+    std::chrono::duration<double> appendTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    StringBuilder builder;
+    for(const std::string & fragment : fragments){
+      builder.append(fragment);
+    }
+    std::string builderReport = builder.build();
+    std::chrono::duration<double> builderTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    Rope rope;
+    for(const std::string & fragment : fragments){
+      rope.append(fragment);
+    }
+    std::string ropeReport = rope.toString();
+    std::chrono::duration<double> ropeTime = std::chrono::steady_clock::now() - start;
+
+    if(builderReport != appendReport || ropeReport != appendReport
+       || (!skipConcat && concatReport != appendReport)){
+      asyncOut() << "Reports differ!" << std::endl;
+      return;
+    }
+
+    asyncOut() << fragmentCount << "\t" << builderReport.size() << "\t";
+    if(skipConcat){
+      asyncOut() << "skipped";
+    }
+    else{
+      asyncOut() << concatTime.count();
+    }
+    asyncOut() << "\t" << appendTime.count() << "\t" << builderTime.count()
+	       << "\t" << ropeTime.count() << "\n";
+    skipConcat = skipConcat || 100.0 * concatTime.count() > concatTimeLimit;
+  }
+
+  // Editing the middle of a large text.
+  const std::size_t editCount = 10000;
+  std::string text(1000000, '.');
+  Rope ropeText(text);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(std::size_t edit = 0; edit < editCount; ++edit){
+    std::size_t position = (edit * 7919) % text.size();
+    text.insert(position, "edit");
+    text.erase(position / 2, 2);
+  }
+  std::chrono::duration<double> stringEditTime = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for(std::size_t edit = 0; edit < editCount; ++edit){
+    std::size_t position = (edit * 7919) % ropeText.length();
+    ropeText.insert(position, "edit");
+    ropeText.erase(position / 2, 2);
+  }
+  std::chrono::duration<double> ropeEditTime = std::chrono::steady_clock::now() - start;
+
+  asyncOut() << "\n" << editCount << " insert/erase pairs in a " << text.size() 
+	     << " character text:\n"
+	     << "std::string => " << stringEditTime.count() << " s\n"
+	     << "Rope => " << ropeEditTime.count() << " s ("
+	     << (ropeText.toString() == text ? "identical" : "DIFFERENT") << " result)"
+	     << std::endl;
+}
+
+/* STRUCTURE OF ARRAYS:
+ * ====================
+ * UsingTheThisPointer::setVars() updates ONE object and prints its 
+ * values. To apply the same update to millions of records, storing an
+ * ARRAY OF OBJECTS (each holding an int and a double) is inefficient:
+ * the ints and doubles are interleaved in memory, and printing on every
+ * call dominates the run time.
+ *
+ * Instead, a STRUCTURE OF ARRAYS stores all the intVar values in one
+ * contiguous COLUMN and all the doubleVar values in another. The update
+ * can then be applied to several neighbouring values at once using the
+ * processor's SIMD (Single Instruction, Multiple Data) instructions. 
+ * SIMD loads and stores are fastest when the data are ALIGNED to a 
+ * multiple of the SIMD register width, so the columns are allocated on
+ * 64-byte (cache line) boundaries.
+ */
+template<typename T>
+class AlignedColumn {
+
+  T * values;
+  std::size_t count;
+
+public :
+
+  static const std::size_t alignment = 64;
+
+  explicit AlignedColumn(std::size_t count):
+    values(nullptr),
+    count(count)
+  {
+    void * memory = nullptr;
+    if(::posix_memalign(&memory, alignment, std::max<std::size_t>(1, count) * sizeof(T)) != 0){
+      throw std::bad_alloc();
+    }
+    values = static_cast<T *>(memory);
+    std::fill(values, values + count, T());
+  }
+
+  AlignedColumn(const AlignedColumn &) = delete;
+  AlignedColumn & operator=(const AlignedColumn &) = delete;
+
+  ~AlignedColumn()
+  {
+    std::free(values);
+  }
+
+  T * data(){
+    return values;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  T & operator[](std::size_t index){
+    return values[index];
+  }
+
+};
+
+class UsingTheThisPointerBatch {
+
+  AlignedColumn<int> intVars;
+  AlignedColumn<double> doubleVars;
+
+  /* Apply setVars() to records [begin, end). "begin" must be a multiple
+   * of the block size so that stores to the columns are aligned. The 
+   * arguments may point into the columns themselves.
+   */
+  void setVarsRange(const int * intArgs, const double * doubleArgs, 
+		    std::size_t begin, std::size_t end){
+    std::size_t index = begin;
+#if defined(__AVX2__)
+    // 8 ints and 2 x 4 doubles per step using 256-bit registers.
+    const __m256i intOne = _mm256_set1_epi32(1);
+    const __m256d doubleOne = _mm256_set1_pd(1.0);
+    for(; index + 8 <= end; index += 8){
+      __m256i ints = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(intArgs + index));
+      _mm256_store_si256(reinterpret_cast<__m256i *>(intVars.data() + index), 
+			 _mm256_add_epi32(ints, intOne));
+      _mm256_store_pd(doubleVars.data() + index, 
+		      _mm256_add_pd(_mm256_loadu_pd(doubleArgs + index), doubleOne));
+      _mm256_store_pd(doubleVars.data() + index + 4, 
+		      _mm256_add_pd(_mm256_loadu_pd(doubleArgs + index + 4), doubleOne));
+    }
+#elif defined(__SSE2__)
+    // 4 ints and 2 x 2 doubles per step using 128-bit registers.
+    const __m128i intOne = _mm_set1_epi32(1);
+    const __m128d doubleOne = _mm_set1_pd(1.0);
+    for(; index + 4 <= end; index += 4){
+      __m128i ints = _mm_loadu_si128(reinterpret_cast<const __m128i *>(intArgs + index));
+      _mm_store_si128(reinterpret_cast<__m128i *>(intVars.data() + index), 
+		      _mm_add_epi32(ints, intOne));
+      _mm_store_pd(doubleVars.data() + index, 
+		   _mm_add_pd(_mm_loadu_pd(doubleArgs + index), doubleOne));
+      _mm_store_pd(doubleVars.data() + index + 2, 
+		   _mm_add_pd(_mm_loadu_pd(doubleArgs + index + 2), doubleOne));
+    }
+#endif
+    // Remaining records (or all of them without SIMD support).
+    for(; index < end; ++index){
+      intVars[index] = intArgs[index] + 1;
+      doubleVars[index] = doubleArgs[index] + 1.0;
+    }
+  }
+
+public :
+
+  // Records per SIMD block; a whole cache line of doubles.
+  static const std::size_t blockSize = 8;
+
+  explicit UsingTheThisPointerBatch(std::size_t count):
+    intVars(count),
+    doubleVars(count)
+  {}
+
+  std::size_t size() const {
+    return intVars.size();
+  }
+
+  int getIntVar(std::size_t index){
+    return intVars[index];
+  }
+
+  double getDoubleVar(std::size_t index){
+    return doubleVars[index];
+  }
+
+  // Direct access to the columns, e.g. to update them in place.
+  int * getIntVars(){
+    return intVars.data();
+  }
+
+  double * getDoubleVars(){
+    return doubleVars.data();
+  }
+
+  /* Equivalent to calling setVars(intArgs[i], doubleArgs[i]) for every
+   * record i, without printing anything.
+   */
+  void setVars(const int * intArgs, const double * doubleArgs){
+    setVarsRange(intArgs, doubleArgs, 0, size());
+  }
+
+  /* Multithreaded version for arrays much larger than the cache. Each 
+   * thread updates one contiguous, block-aligned range of records.
+   */
+  void setVars(const int * intArgs, const double * doubleArgs, unsigned int threadCount){
+    if(threadCount == 0){
+      threadCount = 1;
+    }
+    std::size_t blocks = (size() + blockSize - 1) / blockSize;
+    std::size_t chunkSize = blockSize * ((blocks + threadCount - 1) / threadCount);
+    std::vector<std::thread> threads;
+    for(std::size_t begin = 0; begin < size(); begin += chunkSize){
+      threads.push_back(std::thread(&UsingTheThisPointerBatch::setVarsRange, this, intArgs, doubleArgs,
+				    begin, std::min(size(), begin + chunkSize)));
+    }
+    for(std::thread & thread : threads){
+      thread.join();
+    }
+  }
+
+};
+
+// Record layout used by an ARRAY OF STRUCTURES, for comparison.
+struct IntDoubleRecord {
+  int intVar;
+  double doubleVar;
+};
+
+void batchSetVarsDemo(){ // Invoke with option 12.
+  asyncOut() << "batchSetVarsDemo():\n" << std::endl;
+
+  const std::size_t recordCount = 10000000;
+  const int repeats = 5;
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<int> intArgs(recordCount);
+  std::vector<double> doubleArgs(recordCount);
+  for(std::size_t index = 0; index < recordCount; ++index){
+    intArgs[index] = static_cast<int>(index) + 41;
+    doubleArgs[index] = index + 2.14;
+  }
+
+  // Array of structures: one record at a time.
+  std::vector<IntDoubleRecord> records(recordCount);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int repeat = 0; repeat < repeats; ++repeat){
+    for(std::size_t index = 0; index < recordCount; ++index){
+      records[index].intVar = intArgs[index] + 1;
+      records[index].doubleVar = doubleArgs[index] + 1.0;
+    }
+  }
+  std::chrono::duration<double, std::milli> recordTime = std::chrono::steady_clock::now() - start;
+
+  // Structure of arrays: SIMD blocks, first on one thread, then several.
+  UsingTheThisPointerBatch batch(recordCount);
+  start = std::chrono::steady_clock::now();
+  for(int repeat = 0; repeat < repeats; ++repeat){
+    batch.setVars(intArgs.data(), doubleArgs.data());
+  }
+  std::chrono::duration<double, std::milli> batchTime = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for(int repeat = 0; repeat < repeats; ++repeat){
+    batch.setVars(intArgs.data(), doubleArgs.data(), threadCount);
+  }
+  std::chrono::duration<double, std::milli> threadedTime = std::chrono::steady_clock::now() - start;
+
+  bool identical = true;
+  for(std::size_t index = 0; index < recordCount; ++index){
+    identical = identical && batch.getIntVar(index) == records[index].intVar
+      && batch.getDoubleVar(index) == records[index].doubleVar;
+  }
+
+  // Updating in place: the columns are both the arguments and the result.
+  batch.setVars(batch.getIntVars(), batch.getDoubleVars());
+
+  asyncOut() << "Record 0 after setVars(41, 2.14) twice => intVar " << batch.getIntVar(0)
+	     << ", doubleVar " << batch.getDoubleVar(0) << "\n"
+#if defined(__AVX2__)
+	     << "SIMD => AVX2\n"
+#elif defined(__SSE2__)
+	     << "SIMD => SSE2\n"
+#else
+	     << "SIMD => none\n"
+#endif
+	     << recordCount << " records, mean of " << repeats << " repeats:\n"
+	     << "Array of structures => " << recordTime.count() / repeats << " ms\n"
+	     << "Structure of arrays => " << batchTime.count() / repeats << " ms\n"
+	     << "Structure of arrays, " << threadCount << " thread(s) => " 
+	     << threadedTime.count() / repeats << " ms\n"
+	     << "Results " << (identical ? "identical" : "DIFFERENT")
+	     << std::endl;
+}
+
+/* THE DEMONSTRATION REGISTRY:
+ * ============================
+ * Rather than selecting a demonstration with a long switch statement, 
+ * each demonstration function is listed, together with its name, in an 
+ * ARRAY. The option number used to invoke a demonstration is simply its
+ * position in the array.
+ *
+ * NOTE: The identifier of a function (without parentheses) evaluates
+ *       to a POINTER to that function, which can be stored and called
+ *       later.
+ */
+struct DemoEntry {
+  const char * name;
+  void (*function)();
+};
+
+const DemoEntry demoRegistry[] = {
+  {"usingThisDemo", usingThisDemo},
+  {"minimalClassDemo", minimalClassDemo},
+  {"constructorClassDemo", constructorClassDemo},
+  {"stringConcatDemo", stringConcatDemo},
+  {"assignmentOperatorOverloadDemo", assignmentOperatorOverloadDemo},
+  {"inheritenceDemo", inheritenceDemo},
+  {"baseInitDemo", baseInitDemo},
+  {"snapshotDemo", snapshotDemo},
+  {"printerFleetDemo", printerFleetDemo},
+  {"staticDispatchDemo", staticDispatchDemo},
+  {"deviceFleetDemo", deviceFleetDemo},
+  {"stringBuilderDemo", stringBuilderDemo},
+  {"batchSetVarsDemo", batchSetVarsDemo}
+};
+
+const std::size_t demoCount = sizeof(demoRegistry) / sizeof(demoRegistry[0]);
+
+/* Find a demonstration by option number or by name. Returns nullptr if
+ * there is no such demonstration.
+ */
+const DemoEntry * findDemo(const std::string & nameOrOption){
+  if(!nameOrOption.empty() 
+     && nameOrOption.find_first_not_of("0123456789") == std::string::npos){
+    std::size_t option = std::strtoul(nameOrOption.c_str(), nullptr, 10);
+    return option < demoCount ? &demoRegistry[option] : nullptr;
+  }
+  for(const DemoEntry & demo : demoRegistry){
+    if(nameOrOption == demo.name){
+      return &demo;
+    }
+  }
+  return nullptr;
+}
+
+/* HARDWARE PERFORMANCE COUNTERS:
+ * ==============================
+ * Modern processors count events such as clock CYCLES, INSTRUCTIONS 
+ * executed and CACHE MISSES. On Linux these counters can be read with 
+ * the perf_event_open() system call. The counters are INHERITED by any
+ * thread that the measured code starts, so work done on worker threads
+ * is counted too. (Inherited counters cannot be read as a group, so each
+ * counter is started, stopped and read separately.)
+ *
+ * Access may be restricted (see /proc/sys/kernel/perf_event_paranoid),
+ * or unsupported in virtual machines, in which case isAvailable() is 
+ * false and the counters are simply not reported.
+ */
+class HardwareCounters {
+
+public :
+
+  static const int counterCount = 3;
+
+private :
+
+  int fileDescriptors[counterCount];
+  std::uint64_t values[counterCount];
+  std::string error;
+
+public :
+
+  HardwareCounters()
+  {
+    for(int counter = 0; counter < counterCount; ++counter){
+      fileDescriptors[counter] = -1;
+      values[counter] = 0;
+    }
+#ifdef __linux__
+    const std::uint64_t configs[counterCount] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES
+    };
+    for(int counter = 0; counter < counterCount; ++counter){
+      perf_event_attr attributes;
+      std::memset(&attributes, 0, sizeof(attributes));
+      attributes.size = sizeof(attributes);
+      attributes.type = PERF_TYPE_HARDWARE;
+      attributes.config = configs[counter];
+      attributes.disabled = 1;
+      // Also count threads created after the counter is opened.
+      attributes.inherit = 1;
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      fileDescriptors[counter] = static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1,
+							    -1, 0));
+      if(fileDescriptors[counter] < 0){
+	error = std::string("perf_event_open: ") + std::strerror(errno);
+	closeAll();
+	return;
+      }
+    }
+#else
+    error = "hardware counters are only supported on Linux";
+#endif
+  }
+
+  HardwareCounters(const HardwareCounters &) = delete;
+  HardwareCounters & operator=(const HardwareCounters &) = delete;
+
+  ~HardwareCounters()
+  {
+    closeAll();
+  }
+
+  void closeAll(){
+    for(int counter = 0; counter < counterCount; ++counter){
+      if(fileDescriptors[counter] >= 0){
+	::close(fileDescriptors[counter]);
+	fileDescriptors[counter] = -1;
+      }
+    }
+  }
+
+  bool isAvailable() const {
+    return fileDescriptors[0] >= 0;
+  }
+
+  const std::string & getError() const {
+    return error;
+  }
+
+  void start(){
+#ifdef __linux__
+    if(isAvailable()){
+      for(int counter = 0; counter < counterCount; ++counter){
+	::ioctl(fileDescriptors[counter], PERF_EVENT_IOC_RESET, 0);
+	::ioctl(fileDescriptors[counter], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop(){
+#ifdef __linux__
+    if(isAvailable()){
+      for(int counter = 0; counter < counterCount; ++counter){
+	::ioctl(fileDescriptors[counter], PERF_EVENT_IOC_DISABLE, 0);
+      }
+      /* Counts from worker threads are included once those threads have
+       * finished, which they have by the time a demonstration returns.
+       */
+      for(int counter = 0; counter < counterCount; ++counter){
+	std::uint64_t value(0);
+	if(::read(fileDescriptors[counter], &value, sizeof(value)) == sizeof(value)){
+	  values[counter] = value;
+	}
+      }
+    }
+#endif
+  }
+
+  std::uint64_t getCycles() const {
+    return values[0];
+  }
+
+  std::uint64_t getInstructions() const {
+    return values[1];
+  }
+
+  std::uint64_t getCacheMisses() const {
+    return values[2];
+  }
+
+};
+
+/* A stream buffer that throws away everything written to it. The text 
+ * is still FORMATTED, so benchmarks include the cost of formatting.
+ */
+class DiscardingBuffer : public std::streambuf {
+
+  char area[4096];
+
+protected :
+
+  int_type overflow(int_type character) override {
+    setp(area, area + sizeof(area));
+    return traits_type::not_eof(character);
+  }
+
+public :
+
+  DiscardingBuffer()
+  {
+    setp(area, area + sizeof(area));
+  }
+
+};
+
+/* Run a demonstration "warmUp" times without measurement, then 
+ * "iterations" times measuring each run, and report the results. The 
+ * output of the demonstration is discarded while it is being measured.
+ */
+void benchmarkDemo(const DemoEntry & demo, std::size_t iterations, std::size_t warmUp){
+  std::vector<double> times;
+  times.reserve(iterations);
+  HardwareCounters counters;
+  {
+    DiscardingBuffer discard;
+    AsyncOutputRedirect redirect(&discard);
+    for(std::size_t iteration = 0; iteration < warmUp; ++iteration){
+      demo.function();
+    }
+    counters.start();
+    for(std::size_t iteration = 0; iteration < iterations; ++iteration){
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      demo.function();
+      std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+      times.push_back(elapsed.count());
+    }
+    counters.stop();
+  }
+
+  double total(0.0);
+  for(double time : times){
+    total += time;
+  }
+  std::sort(times.begin(), times.end());
+  asyncOut() << demo.name << ": " << iterations << " iterations after " 
+	     << warmUp << " warm-up\n";
+  if(iterations == 0){
+    return;
+  }
+  asyncOut() << "Wall-clock (us) => min " << times.front()
+	     << ", mean " << total / iterations
+	     << ", p50 " << sortedPercentile(times, 50.0)
+	     << ", p90 " << sortedPercentile(times, 90.0)
+	     << ", p99 " << sortedPercentile(times, 99.0)
+	     << ", max " << times.back() << "\n";
+  if(counters.isAvailable()){
+    asyncOut() << "Per iteration, all threads => cycles " << counters.getCycles() / iterations
+	       << ", instructions " << counters.getInstructions() / iterations
+	       << ", cache misses " << counters.getCacheMisses() / iterations
+	       << ", IPC " << (counters.getCycles() > 0 
+			       ? static_cast<double>(counters.getInstructions()) / counters.getCycles() 
+			       : 0.0)
+	       << "\n";
+  }
+  else{
+    asyncOut() << "Hardware counters unavailable (" << counters.getError() << ")\n";
+  }
+  asyncOut() << std::endl;
+}
+
+/* Run several demonstrations CONCURRENTLY on a pool of threads. Each
+ * thread REDIRECTS its asyncOut() into a separate buffer while it runs
+ * a demonstration, and the buffers are written once every demonstration
+ * has finished, in the order in which they were requested. The output 
+ * is therefore identical to running the demonstrations one at a time.
+ */
+void runDemosConcurrently(const std::vector<const DemoEntry *> & demos){
+  std::vector<std::string> outputs(demos.size());
+  std::atomic<std::size_t> nextDemo(0);
+  unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  threadCount = std::min<std::size_t>(threadCount, demos.size());
+  
+  std::vector<std::thread> pool;
+  for(unsigned int thread = 0; thread < threadCount; ++thread){
+    pool.push_back(std::thread([&](){
+	  // Each thread takes the next demonstration until none are left.
+	  for(std::size_t index = nextDemo++; index < demos.size(); index = nextDemo++){
+	    std::stringbuf capture;
+	    {
+	      AsyncOutputRedirect redirect(&capture);
+	      demos[index]->function();
+	    }
+	    outputs[index] = capture.str();
+	  }
+	}));
+  }
+  for(std::thread & thread : pool){
+    thread.join();
+  }
+
+  for(const std::string & output : outputs){
+    asyncOut() << output;
+  }
+  asyncOut() << std::flush;
+}
+
+/* Parse a whole command line argument as a count between minimum and
+ * maximum. Returns false if it is not a number or is out of range.
+ */
+bool parseCount(const char * argument, std::size_t minimum, std::size_t maximum,
+		std::size_t & count){
+  char * parsedEnd = nullptr;
+  errno = 0;
+  unsigned long long value = std::strtoull(argument, &parsedEnd, 10);
+  count = static_cast<std::size_t>(value);
+  return parsedEnd != argument && *parsedEnd == '\0' && errno == 0
+    && argument[0] != '-' && value >= minimum && value <= maximum;
+}
+
+void printUsage(const char * program){
+  asyncOut() << "Usage: " << program << " <option|name>\n"
+	     << "       " << program << " bench <option|name> [iterations] [warmUp]\n"
+	     << "       " << program << " parallel [option|name]...\n\n"
+	     << "Demonstrations:\n";
+  for(std::size_t option = 0; option < demoCount; ++option){
+    asyncOut() << "  " << option << "\t" << demoRegistry[option].name << "\n";
+  }
+  asyncOut() << std::endl;
+}
+
+// main function that calls all demonstration functions
+int main (int argc, char * argv[]){
+
+  // Without any arguments there is nothing to run.
+  if(argc < 2){
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // Benchmark a demonstration: bench <option|name> [iterations] [warmUp]
+  if(std::string(argv[1]) == "bench"){
+    const DemoEntry * demo = argc > 2 ? findDemo(argv[2]) : nullptr;
+    if(demo == nullptr){
+      printUsage(argv[0]);
+      return 1;
+    }
+    // Each measured iteration stores its time, which limits the count.
+    const std::size_t maximumIterations = 100000000;
+    std::size_t iterations(100), warmUp(10);
+    if((argc > 3 && !parseCount(argv[3], 1, maximumIterations, iterations))
+       || (argc > 4 && !parseCount(argv[4], 0, maximumIterations, warmUp))){
+      asyncOut() << "iterations must be a whole number from 1 to " << maximumIterations
+		 << ", and warmUp from 0 to " << maximumIterations << "\n\n";
+      printUsage(argv[0]);
+      return 1;
+    }
+    benchmarkDemo(*demo, iterations, warmUp);
+    return 0;
+  }
+
+  /* Run several demonstrations at once: parallel [option|name]...
+   * With no demonstrations listed, run all of them. Each demonstration
+   * may only be listed once, since two copies running at the same time
+   * could interfere (e.g. by writing the same snapshot file).
+   */
+  if(std::string(argv[1]) == "parallel"){
+    std::vector<const DemoEntry *> demos;
+    for(int argument = 2; argument < argc; ++argument){
+      const DemoEntry * demo = findDemo(argv[argument]);
+      if(demo == nullptr){
+	printUsage(argv[0]);
+	return 1;
+      }
+      if(std::find(demos.begin(), demos.end(), demo) != demos.end()){
+	asyncOut() << demo->name << " is listed more than once" << std::endl;
+	return 1;
+      }
+      demos.push_back(demo);
+    }
+    if(demos.empty()){
+      for(const DemoEntry & demo : demoRegistry){
+	demos.push_back(&demo);
+      }
+    }
+    runDemosConcurrently(demos);
+    return 0;
+  }
+
+  // Call requested demonstration function
+  const DemoEntry * demo = findDemo(argv[1]);
+  if(demo == nullptr){
+    asyncOut() << "Unknown Option" << std::endl;
+    return 1;
+  }
+  demo->function();
   return 0;
 }
@@ -0,0 +1,610 @@
+// A SEARCH INDEX AND QUERY SERVER FOR SORTED NUMBERS
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+// POSIX headers used for Unix domain sockets
+// SIMD intrinsics are only available when compiling for x86 processors
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* This program answers questions about the numbers that stlIntro writes
+ * to its (sorted) output file:
+ *
+ * 1) lower x      : How many values are less than x, and what is the
+ *                   first value that is NOT less than x?
+ * 2) count a b    : How many values lie in the range [a, b]?
+ * 3) nearest x    : Which value is closest to x?
+ *
+ * Rather than reloading the file for every question, a SERVER process
+ * loads it once, builds an INDEX and answers questions sent to it over
+ * a UNIX DOMAIN SOCKET (a file-system path that processes on the same
+ * machine can connect to, like a network port).
+ */
+
+/* THE EYTZINGER LAYOUT:
+ * =====================
+ * std::lower_bound performs a BINARY SEARCH of a sorted array. Each step
+ * jumps to a distant part of the array, so nearly every step is a CACHE
+ * MISS, and the processor cannot predict which way each comparison will
+ * go.
+ *
+ * The EYTZINGER layout stores the same values in the order in which a
+ * binary search visits them: the middle value first, then the middles
+ * of the two halves, and so on, exactly like the levels of a binary
+ * tree. The two children of element k are elements 2k and 2k+1, so:
+ *
+ * - The next step is computed WITHOUT A BRANCH: k = 2k + (value < x).
+ * - The first few levels share a handful of cache lines, and the
+ *   descendants of element k, four levels down, are CONTIGUOUS, so they
+ *   can be PREFETCHED while the current level is being compared.
+ *
+ * The tree is padded with +infinity to a complete tree, so every search
+ * takes exactly the same number of steps. This allows a BATCH of
+ * searches to advance one level at a time in lock-step, which keeps
+ * many memory accesses in flight at once. With AVX2 each step of four
+ * searches is a single GATHER of their four tree elements, one vector
+ * comparison and one vector update of their positions (compile with
+ * -mavx2). With SSE2 two comparisons are done at once.
+ *
+ * Ranks are stored as 32-bit integers, so an index holds at most
+ * maximumSize values.
+ */
+class EytzingerIndex {
+
+  std::vector<double> sortedValues;
+  /* Element 0 is unused so that the children of k are 2k and 2k+1. The
+   * storage is over-allocated so that "tree" can start on a 64-byte cache
+   * line boundary, which makes the 16 descendants of any element, four
+   * levels down, occupy EXACTLY two cache lines.
+   */
+  std::vector<double> treeStorage;
+  double * tree;
+  std::size_t treeSize;
+  // Rank (position in sortedValues) of each tree element.
+  std::vector<std::uint32_t> ranks;
+  unsigned int levels;
+
+  // Prefetch both cache lines holding the descendants of a node.
+  void prefetchDescendants(std::size_t node) const {
+    std::size_t first = std::min(treeSize - 1, 16 * node);
+    __builtin_prefetch(tree + first);
+    __builtin_prefetch(tree + std::min(treeSize - 1, first + 8));
+  }
+
+  // Fill the tree IN ORDER, which places sorted values in Eytzinger order.
+  std::size_t fill(std::size_t position, std::size_t node){
+    if(node < treeSize){
+      position = fill(position, 2 * node);
+      if(position < sortedValues.size()){
+	tree[node] = sortedValues[position];
+	ranks[node] = static_cast<std::uint32_t>(position);
+      }
+      ++position;
+      position = fill(position, 2 * node + 1);
+    }
+    return position;
+  }
+
+  /* Convert the final position of a search, which has fallen off the
+   * bottom of the tree, into the node where the search last went LEFT.
+   */
+  std::uint32_t rankOfResult(std::size_t node) const {
+    node >>= __builtin_ctzll(~static_cast<unsigned long long>(node)) + 1;
+    return node == 0 ? static_cast<std::uint32_t>(sortedValues.size()) : ranks[node];
+  }
+
+public :
+
+  static const std::size_t maximumSize = std::numeric_limits<std::uint32_t>::max();
+
+  explicit EytzingerIndex(const std::vector<double> & values):
+    sortedValues(values),
+    tree(nullptr),
+    treeSize(0),
+    levels(0)
+  {
+    if(!std::is_sorted(sortedValues.begin(), sortedValues.end())){
+      std::sort(sortedValues.begin(), sortedValues.end());
+    }
+    // A complete tree with 2^levels - 1 elements.
+    while(((std::size_t(1) << levels) - 1) < sortedValues.size()){
+      ++levels;
+    }
+    treeSize = std::size_t(1) << levels;
+    treeStorage.assign(treeSize + 8, std::numeric_limits<double>::infinity());
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(treeStorage.data());
+    tree = treeStorage.data() + (64 - address % 64) % 64 / sizeof(double);
+    ranks.assign(treeSize, static_cast<std::uint32_t>(sortedValues.size()));
+    fill(0, 1);
+  }
+
+  // "tree" points into treeStorage, so a copy would point into the original.
+  EytzingerIndex(const EytzingerIndex &) = delete;
+  EytzingerIndex & operator=(const EytzingerIndex &) = delete;
+
+  std::size_t size() const {
+    return sortedValues.size();
+  }
+
+  double value(std::size_t rank) const {
+    return sortedValues[rank];
+  }
+
+  // Number of values less than x, i.e. the rank of the lower bound.
+  std::uint32_t lowerBound(double x) const {
+    std::size_t node = 1;
+    for(unsigned int level = 0; level < levels; ++level){
+      prefetchDescendants(node);
+      node = 2 * node + (tree[node] < x);
+    }
+    return rankOfResult(node);
+  }
+
+  // Number of values less than or equal to x.
+  std::uint32_t upperBound(double x) const {
+    std::size_t node = 1;
+    for(unsigned int level = 0; level < levels; ++level){
+      prefetchDescendants(node);
+      node = 2 * node + (tree[node] <= x);
+    }
+    return rankOfResult(node);
+  }
+
+  /* lowerBound() for a whole batch of queries, advancing every query by
+   * one level of the tree at a time.
+   */
+  void lowerBounds(const double * queries, std::uint32_t * results, std::size_t count) const {
+    const std::size_t laneCount = 16;
+    std::size_t begin = 0;
+#if defined(__AVX2__)
+    // 16 searches as 4 vectors of 4 positions (64-bit integers) each.
+    const __m256i one = _mm256_set1_epi64x(1);
+    for(; begin + laneCount <= count; begin += laneCount){
+      __m256i nodes[4];
+      __m256d keys[4];
+      for(int vector = 0; vector < 4; ++vector){
+	nodes[vector] = one;
+	keys[vector] = _mm256_loadu_pd(queries + begin + 4 * vector);
+      }
+      for(unsigned int level = 0; level < levels; ++level){
+	for(int vector = 0; vector < 4; ++vector){
+	  // Load tree[node] for all four searches with one gather.
+	  __m256d values = _mm256_i64gather_pd(tree, nodes[vector], sizeof(double));
+	  // All ones where tree[node] < x; shifting leaves 1 or 0.
+	  __m256i goRight = _mm256_srli_epi64(_mm256_castpd_si256(_mm256_cmp_pd(values, keys[vector],
+										_CMP_LT_OQ)), 63);
+	  nodes[vector] = _mm256_add_epi64(_mm256_slli_epi64(nodes[vector], 1), goRight);
+	}
+      }
+      for(int vector = 0; vector < 4; ++vector){
+	alignas(32) std::uint64_t finalNodes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(finalNodes), nodes[vector]);
+	for(int lane = 0; lane < 4; ++lane){
+	  results[begin + 4 * vector + lane] = rankOfResult(finalNodes[lane]);
+	}
+      }
+    }
+#elif defined(__SSE2__)
+    // 16 searches, compared two at a time.
+    for(; begin + laneCount <= count; begin += laneCount){
+      std::size_t nodes[laneCount];
+      for(std::size_t lane = 0; lane < laneCount; ++lane){
+	nodes[lane] = 1;
+      }
+      for(unsigned int level = 0; level < levels; ++level){
+	for(std::size_t lane = 0; lane < laneCount; lane += 2){
+	  __m128d values = _mm_set_pd(tree[nodes[lane + 1]], tree[nodes[lane]]);
+	  // Bit i of the mask is set if search lane + i goes right.
+	  int goRight = _mm_movemask_pd(_mm_cmplt_pd(values, _mm_loadu_pd(queries + begin + lane)));
+	  nodes[lane] = 2 * nodes[lane] + (goRight & 1);
+	  nodes[lane + 1] = 2 * nodes[lane + 1] + (goRight >> 1);
+	}
+      }
+      for(std::size_t lane = 0; lane < laneCount; ++lane){
+	results[begin + lane] = rankOfResult(nodes[lane]);
+      }
+    }
+#endif
+    // Remaining queries (or all of them without SIMD support).
+    std::size_t nodes[laneCount];
+    for(; begin < count; begin += laneCount){
+      std::size_t lanes = std::min(laneCount, count - begin);
+      for(std::size_t lane = 0; lane < lanes; ++lane){
+	nodes[lane] = 1;
+      }
+      for(unsigned int level = 0; level < levels; ++level){
+	for(std::size_t lane = 0; lane < lanes; ++lane){
+	  nodes[lane] = 2 * nodes[lane] + (tree[nodes[lane]] < queries[begin + lane]);
+	}
+      }
+      for(std::size_t lane = 0; lane < lanes; ++lane){
+	results[begin + lane] = rankOfResult(nodes[lane]);
+      }
+    }
+  }
+
+  // Number of values in the range [low, high].
+  std::size_t countInRange(double low, double high) const {
+    if(high < low){
+      return 0;
+    }
+    return upperBound(high) - lowerBound(low);
+  }
+
+  /* Value closest to x, given the rank of its lower bound. Returns false
+   * if the index is empty.
+   */
+  bool nearest(double x, std::uint32_t lowerRank, double & result) const {
+    if(sortedValues.empty()){
+      return false;
+    }
+    if(lowerRank == sortedValues.size()){
+      result = sortedValues.back();
+    }
+    else if(lowerRank == 0 || sortedValues[lowerRank] - x < x - sortedValues[lowerRank - 1]){
+      result = sortedValues[lowerRank];
+    }
+    else{
+      result = sortedValues[lowerRank - 1];
+    }
+    return true;
+  }
+
+};
+
+// Read whitespace-separated numbers from a text file.
+bool readNumbers(const char * fileName, std::vector<double> & values){
+  std::ifstream inputFile(fileName);
+  if(!inputFile.is_open()){
+    return false;
+  }
+  double number(0.0);
+  while(inputFile >> number){
+    if(values.size() == EytzingerIndex::maximumSize){
+      std::cerr << fileName << " has more than " << EytzingerIndex::maximumSize
+		<< " values" << std::endl;
+      return false;
+    }
+    values.push_back(number);
+  }
+  return true;
+}
+
+/* Answer a batch of query lines, appending one response line per query
+ * to "responses". The lower bounds needed by "lower" and "nearest"
+ * queries are all looked up together as one batch.
+ */
+void answerQueries(const EytzingerIndex & index, const std::vector<std::string> & lines,
+		   std::string & responses){
+  std::vector<std::string> commands(lines.size());
+  std::vector<double> firstArguments(lines.size(), 0.0);
+  std::vector<double> secondArguments(lines.size(), 0.0);
+  std::vector<bool> valid(lines.size(), false);
+  for(std::size_t line = 0; line < lines.size(); ++line){
+    std::istringstream parser(lines[line]);
+    parser >> commands[line] >> firstArguments[line];
+    valid[line] = !parser.fail();
+    if(commands[line] == "count"){
+      parser >> secondArguments[line];
+      valid[line] = valid[line] && !parser.fail();
+    }
+  }
+
+  std::vector<std::uint32_t> lowerRanks(lines.size());
+  index.lowerBounds(firstArguments.data(), lowerRanks.data(), lines.size());
+
+  std::ostringstream output;
+  output.precision(std::numeric_limits<double>::digits10);
+  for(std::size_t line = 0; line < lines.size(); ++line){
+    double result(0.0);
+    if(!valid[line]){
+      output << "error: expected \"lower x\", \"count a b\" or \"nearest x\"\n";
+    }
+    else if(commands[line] == "lower"){
+      output << lowerRanks[line] << " ";
+      if(lowerRanks[line] < index.size()){
+	output << index.value(lowerRanks[line]) << "\n";
+      }
+      else{
+	output << "end\n";
+      }
+    }
+    else if(commands[line] == "count"){
+      output << index.countInRange(firstArguments[line], secondArguments[line]) << "\n";
+    }
+    else if(commands[line] == "nearest"){
+      if(index.nearest(firstArguments[line], lowerRanks[line], result)){
+	output << result << "\n";
+      }
+      else{
+	output << "error: empty index\n";
+      }
+    }
+    else{
+      output << "error: unknown query \"" << lines[line] << "\"\n";
+    }
+  }
+  responses += output.str();
+}
+
+// Send an entire buffer through a socket.
+bool sendFully(int socketDescriptor, const std::string & data){
+  std::size_t sent = 0;
+  while(sent < data.size()){
+    ssize_t result = ::send(socketDescriptor, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if(result <= 0){
+      return false;
+    }
+    sent += result;
+  }
+  return true;
+}
+
+/* Counts the client threads that are still running, so that the server
+ * can wait for them before destroying the index that they share.
+ */
+class ActiveClients {
+
+  std::mutex mutex;
+  std::condition_variable allFinished;
+  std::size_t count;
+
+public :
+
+  ActiveClients():
+    count(0)
+  {}
+
+  void add(){
+    std::lock_guard<std::mutex> lock(mutex);
+    ++count;
+  }
+
+  void remove(){
+    std::lock_guard<std::mutex> lock(mutex);
+    if(--count == 0){
+      allFinished.notify_all();
+    }
+  }
+
+  void waitUntilNone(){
+    std::unique_lock<std::mutex> lock(mutex);
+    allFinished.wait(lock, [this](){ return count == 0; });
+  }
+
+};
+
+/* Serve one client: read query lines as they arrive, answering every
+ * complete line received so far as one batch.
+ */
+void serveClient(const EytzingerIndex & index, int clientDescriptor){
+  std::string pending;
+  char buffer[65536];
+  for(;;){
+    ssize_t received = ::recv(clientDescriptor, buffer, sizeof(buffer), 0);
+    if(received <= 0){
+      break;
+    }
+    pending.append(buffer, received);
+    std::size_t lastNewline = pending.rfind('\n');
+    if(lastNewline == std::string::npos){
+      continue;
+    }
+    std::vector<std::string> lines;
+    std::size_t begin = 0;
+    while(begin <= lastNewline){
+      std::size_t end = pending.find('\n', begin);
+      if(end > begin){
+	lines.push_back(pending.substr(begin, end - begin));
+      }
+      begin = end + 1;
+    }
+    pending.erase(0, lastNewline + 1);
+    std::string responses;
+    answerQueries(index, lines, responses);
+    if(!sendFully(clientDescriptor, responses)){
+      break;
+    }
+  }
+  ::close(clientDescriptor);
+}
+
+// Fill in a Unix domain socket address. Returns false if the path is too long.
+bool makeSocketAddress(const char * path, sockaddr_un & address){
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(std::strlen(path) >= sizeof(address.sun_path)){
+    return false;
+  }
+  std::strcpy(address.sun_path, path);
+  return true;
+}
+
+// Load the index once, then answer clients until the process is killed.
+int serve(const char * fileName, const char * socketPath){
+  std::vector<double> values;
+  if(!readNumbers(fileName, values)){
+    std::cerr << "Cannot read " << fileName << std::endl;
+    return 1;
+  }
+  EytzingerIndex index(values);
+
+  sockaddr_un address;
+  int serverDescriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(serverDescriptor < 0 || !makeSocketAddress(socketPath, address)){
+    std::cerr << "Cannot create socket " << socketPath << std::endl;
+    return 3;
+  }
+  /* Remove a socket left behind by a previous server, but never anything
+   * else: a mistyped path must not delete a data file.
+   */
+  struct stat existing;
+  if(::lstat(socketPath, &existing) == 0){
+    if(!S_ISSOCK(existing.st_mode)){
+      std::cerr << socketPath << " exists and is not a socket" << std::endl;
+      ::close(serverDescriptor);
+      return 3;
+    }
+    ::unlink(socketPath);
+  }
+  if(::bind(serverDescriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+     || ::listen(serverDescriptor, 16) != 0){
+    std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+    return 3;
+  }
+  std::cerr << "Serving " << index.size() << " values from " << fileName
+	    << " on " << socketPath << std::endl;
+
+  /* The index is never modified, so clients can be served concurrently.
+   * Errors that affect only one connection, or that pass once clients
+   * disconnect (such as running out of file descriptors), do not stop
+   * the server.
+   */
+  ActiveClients activeClients;
+  int result(0);
+  for(;;){
+    int clientDescriptor = ::accept(serverDescriptor, nullptr, nullptr);
+    if(clientDescriptor < 0){
+      if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO){
+	continue;
+      }
+      if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM){
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	continue;
+      }
+      std::cerr << "Cannot accept clients: " << std::strerror(errno) << std::endl;
+      result = 3;
+      break;
+    }
+    activeClients.add();
+    std::thread([&index, &activeClients, clientDescriptor](){
+	serveClient(index, clientDescriptor);
+	activeClients.remove();
+      }).detach();
+  }
+  ::close(serverDescriptor);
+  // Clients use the index, so it must outlive every client thread.
+  activeClients.waitUntilNone();
+  return result;
+}
+
+/* Send query lines from std::cin to the server and print the responses.
+ * Queries are sent by a separate thread so that a long list of queries
+ * can be streamed without waiting for each response.
+ */
+int query(const char * socketPath){
+  sockaddr_un address;
+  int socketDescriptor = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(socketDescriptor < 0 || !makeSocketAddress(socketPath, address)
+     || ::connect(socketDescriptor, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0){
+    std::cerr << "Cannot connect to " << socketPath << std::endl;
+    return 3;
+  }
+
+  std::thread sender([socketDescriptor](){
+      std::string line;
+      std::string batch;
+      while(std::getline(std::cin, line)){
+	batch += line;
+	batch += '\n';
+	if(batch.size() > 65536){
+	  sendFully(socketDescriptor, batch);
+	  batch.clear();
+	}
+      }
+      sendFully(socketDescriptor, batch);
+      // Tell the server that no more queries will follow.
+      ::shutdown(socketDescriptor, SHUT_WR);
+    });
+
+  char buffer[65536];
+  ssize_t received(0);
+  while((received = ::recv(socketDescriptor, buffer, sizeof(buffer), 0)) > 0){
+    std::cout.write(buffer, received);
+  }
+  std::cout.flush();
+  sender.join();
+  ::close(socketDescriptor);
+  return 0;
+}
+
+// Compare std::lower_bound with the Eytzinger index on random queries.
+int benchmark(const char * fileName, std::size_t queryCount){
+  std::vector<double> values;
+  if(!readNumbers(fileName, values) || values.empty()){
+    std::cerr << "Cannot read " << fileName << std::endl;
+    return 1;
+  }
+  EytzingerIndex index(values);
+  std::sort(values.begin(), values.end());
+
+  std::mt19937_64 generator(42);
+  std::uniform_real_distribution<double> distribution(values.front(), values.back());
+  std::vector<double> queries(queryCount);
+  for(double & query : queries){
+    query = distribution(generator);
+  }
+  std::vector<std::uint32_t> expected(queryCount), single(queryCount), batched(queryCount);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(std::size_t query = 0; query < queryCount; ++query){
+    expected[query] = std::lower_bound(values.begin(), values.end(), queries[query]) - values.begin();
+  }
+  std::chrono::duration<double> binaryTime = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for(std::size_t query = 0; query < queryCount; ++query){
+    single[query] = index.lowerBound(queries[query]);
+  }
+  std::chrono::duration<double> singleTime = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  index.lowerBounds(queries.data(), batched.data(), queryCount);
+  std::chrono::duration<double> batchedTime = std::chrono::steady_clock::now() - start;
+
+  std::cout << index.size() << " values, " << queryCount << " queries\n"
+	    << "std::lower_bound => " << 1.0e9 * binaryTime.count() / queryCount << " ns/query\n"
+	    << "Eytzinger => " << 1.0e9 * singleTime.count() / queryCount << " ns/query\n"
+	    << "Eytzinger, batched => " << 1.0e9 * batchedTime.count() / queryCount << " ns/query\n"
+	    << "Results " << (expected == single && expected == batched ? "identical" : "DIFFERENT")
+	    << std::endl;
+  return expected == single && expected == batched ? 0 : 4;
+}
+
+int main(int argc, char * argv[]){
+  std::string mode(argc > 1 ? argv[1] : "");
+  if(mode == "serve" && argc > 3){
+    return serve(argv[2], argv[3]);
+  }
+  if(mode == "query" && argc > 2){
+    return query(argv[2]);
+  }
+  if(mode == "bench" && argc > 2){
+    return benchmark(argv[2], argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000000);
+  }
+  std::cerr << "Usage: " << argv[0] << " serve <sortedFile> <socketPath>\n"
+	    << "       " << argv[0] << " query <socketPath> < queries\n"
+	    << "       " << argv[0] << " bench <sortedFile> [queryCount]" << std::endl;
+  return 1;
+}
@@ -0,0 +1,104 @@
+// STATIC DISPATCH FOR HETEROGENEOUS COLLECTIONS
+#ifndef STATIC_DISPATCH_H
+#define STATIC_DISPATCH_H
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/* TYPE-SORTED BATCHES:
+ * ====================
+ * When a derived class OVERRIDES a base class method WITHOUT the
+ * "virtual" keyword, the method that is called depends on the STATIC
+ * TYPE of the object. Storing a mixed collection of such objects as
+ * base class pointers would therefore call the WRONG method.
+ *
+ * The classic solution makes the method virtual, which costs an
+ * INDIRECT CALL through the object's VTABLE for every element and
+ * prevents the compiler from INLINING the method.
+ *
+ * The alternative used here stores a mixed collection as ONE
+ * std::vector PER TYPE. Iterating over the collection visits each batch
+ * in turn, and within a batch every element has the same STATIC TYPE,
+ * so the correct overridden method is chosen at COMPILE TIME and may be
+ * inlined.
+ *
+ * NOTE: Elements are visited grouped by type, in the order in which
+ *       the types are listed, NOT in the order in which they were added.
+ */
+template<typename T, typename... Types> struct TypeSortedIndex;
+
+// Position of type T within the list of types.
+template<typename T, typename... Rest>
+struct TypeSortedIndex<T, T, Rest...> {
+  static const std::size_t value = 0;
+};
+
+template<typename T, typename First, typename... Rest>
+struct TypeSortedIndex<T, First, Rest...> {
+  static const std::size_t value = 1 + TypeSortedIndex<T, Rest...>::value;
+};
+
+template<typename... Types>
+class TypeSortedBatches {
+
+  std::tuple<std::vector<Types>...> batches;
+
+  // Recursion over the batches ends once every batch has been visited.
+  template<std::size_t Index, typename Function>
+  typename std::enable_if<Index == sizeof...(Types)>::type
+  forEachBatch(Function &){}
+
+  template<std::size_t Index, typename Function>
+  typename std::enable_if<(Index < sizeof...(Types))>::type
+  forEachBatch(Function & function){
+    for(auto & element : std::get<Index>(batches)){
+      function(element);
+    }
+    forEachBatch<Index + 1>(function);
+  }
+
+  template<std::size_t Index>
+  typename std::enable_if<Index == sizeof...(Types), std::size_t>::type
+  batchSizes() const {
+    return 0;
+  }
+
+  template<std::size_t Index>
+  typename std::enable_if<(Index < sizeof...(Types)), std::size_t>::type
+  batchSizes() const {
+    return std::get<Index>(batches).size() + batchSizes<Index + 1>();
+  }
+
+public :
+
+  // Append an element to the batch for its type.
+  template<typename T>
+  void add(const T & element){
+    batch<T>().push_back(element);
+  }
+
+  // Direct access to the batch of a particular type.
+  template<typename T>
+  std::vector<T> & batch(){
+    return std::get<TypeSortedIndex<T, Types...>::value>(batches);
+  }
+
+  // Total number of elements in all batches.
+  std::size_t size() const {
+    return batchSizes<0>();
+  }
+
+  /* Call function(element) for every element. The function must accept
+   * every type in the collection, for example a class with a TEMPLATED
+   * operator() method.
+   */
+  template<typename Function>
+  void forEach(Function & function){
+    forEachBatch<0>(function);
+  }
+
+};
+
+#endif // STATIC_DISPATCH_H
@@ -12,6 +12,1125 @@
  */
 #include <algorithm>
 
+// Headers used by the alternative processing modes defined below.
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <memory>
+#include <chrono>
+#include <thread>
+// Opens files that may be gzip or Zstandard compressed.
+#include "compressedStreams.h"
+// Huge-page buffers and NUMA page placement for the "numa" mode.
+#include "numaStorage.h"
+// stat() checks that a failed run's output is a regular file to remove.
+#include <sys/stat.h>
+
+/* FIXED-PRECISION MODE:
+ * =====================
+ * Numbers like "261.910" have a FIXED number of decimal places. Instead 
+ * of converting them to double (which cannot represent most decimal
+ * fractions exactly) they can be stored EXACTLY as 64-bit integers 
+ * counting thousandths, i.e. 261910.
+ *
+ * Integers can be sorted by RADIX SORT, which does not compare values at
+ * all. Instead it distributes the values into 256 "buckets" according to
+ * one byte of the value, starting with the least significant byte. After
+ * one STABLE pass per byte the values are sorted. The cost is 
+ * proportional to the number of values, rather than to n log(n) as for
+ * std::sort.
+ *
+ * The sorted integers are written with EXACTLY the original number of
+ * decimal places, so no precision is lost in either direction.
+ */
+
+/* Read whitespace-separated tokens from a stream in large blocks and call
+ * processToken(begin, end) for each one. Stops early, returning false, 
+ * if processToken returns false. Also returns false if the stream fails
+ * (input.bad()), e.g. on a corrupt compressed file, without processing
+ * the token that was cut short.
+ */
+template<typename TokenFunction>
+bool forEachToken(std::istream & input, TokenFunction processToken){
+  std::vector<char> block(1 << 20);
+  std::string carried; // A token that may continue in the next block
+  while(input){
+    input.read(block.data(), block.size());
+    const char * position = block.data();
+    const char * end = position + input.gcount();
+    while(position != end){
+      const char * tokenBegin = position;
+      while(position != end && !std::isspace(static_cast<unsigned char>(*position))){
+	++position;
+      }
+      if(position == end){
+	carried.append(tokenBegin, end);
+	break;
+      }
+      // The token ends at this whitespace character.
+      if(!carried.empty()){
+	carried.append(tokenBegin, position);
+	if(!processToken(carried.data(), carried.data() + carried.size())){
+	  return false;
+	}
+	carried.clear();
+      }
+      else if(tokenBegin != position && !processToken(tokenBegin, position)){
+	return false;
+      }
+      ++position;
+    }
+  }
+  return !input.bad()
+    && (carried.empty() || processToken(carried.data(), carried.data() + carried.size()));
+}
+
+// Largest number of decimal digits that always fits in a std::int64_t.
+const int maximumFixedDigits = 18;
+
+std::int64_t powerOfTen(int exponent){
+  std::int64_t power = 1;
+  for(int digit = 0; digit < exponent; ++digit){
+    power *= 10;
+  }
+  return power;
+}
+
+/* Collects fixed-precision values as integer KEYS. The sign bit of each
+ * value is inverted, so that the keys sort as UNSIGNED integers into the
+ * same order as the values they represent.
+ */
+class FixedPrecisionValues {
+
+  std::vector<std::uint64_t> keys;
+  int precision;       // Number of decimal places
+  bool detectPrecision;
+  int integerDigits;   // Most digits seen before the decimal point
+  std::string error;
+
+  static const std::uint64_t signBit = std::uint64_t(1) << 63;
+
+public :
+
+  // Pass a negative precision to detect it from the input.
+  explicit FixedPrecisionValues(int requestedPrecision):
+    precision(std::max(0, requestedPrecision)),
+    detectPrecision(requestedPrecision < 0),
+    integerDigits(0)
+  {}
+
+  /* Parse one token of the form [+-]digits[.digits]. Returns false if 
+   * the token has another form, more decimal places than the requested
+   * precision, or too many digits to store exactly.
+   */
+  bool add(const char * begin, const char * end){
+    const char * position = begin;
+    bool negative = false;
+    if(position != end && (*position == '-' || *position == '+')){
+      negative = *position == '-';
+      ++position;
+    }
+    std::int64_t magnitude = 0;
+    int digits = 0;
+    int decimals = -1; // Becomes 0 at the decimal point
+    for(; position != end; ++position){
+      if(*position == '.' && decimals < 0){
+	decimals = 0;
+      }
+      else if(*position >= '0' && *position <= '9'){
+	if(++digits > maximumFixedDigits){
+	  error = "too many digits in \"" + std::string(begin, end) + "\"";
+	  return false;
+	}
+	magnitude = 10 * magnitude + (*position - '0');
+	if(decimals >= 0){
+	  ++decimals;
+	}
+      }
+      else{
+	error = "\"" + std::string(begin, end) + "\" is not a fixed-precision decimal";
+	return false;
+      }
+    }
+    if(digits == 0){
+      error = "\"" + std::string(begin, end) + "\" is not a number";
+      return false;
+    }
+    decimals = std::max(0, decimals);
+    integerDigits = std::max(integerDigits, digits - decimals);
+
+    if(decimals > precision){
+      if(!detectPrecision){
+	error = "\"" + std::string(begin, end) + "\" has more than " 
+	  + std::to_string(precision) + " decimal places";
+	return false;
+      }
+      if(integerDigits + decimals > maximumFixedDigits){
+	error = "too many digits to store exactly";
+	return false;
+      }
+      // Rescale every value stored so far to the new precision.
+      std::int64_t scale = powerOfTen(decimals - precision);
+      for(std::uint64_t & key : keys){
+	key = static_cast<std::uint64_t>(static_cast<std::int64_t>(key ^ signBit) * scale) ^ signBit;
+      }
+      precision = decimals;
+    }
+    if(integerDigits + precision > maximumFixedDigits){
+      error = "too many digits to store exactly";
+      return false;
+    }
+    std::int64_t value = magnitude * powerOfTen(precision - decimals);
+    keys.push_back(static_cast<std::uint64_t>(negative ? -value : value) ^ signBit);
+    return true;
+  }
+
+  /* LSD RADIX SORT: one stable counting pass per byte of the keys, least 
+   * significant byte first. Passes in which every key has the same byte
+   * would not change anything and are skipped.
+   */
+  void sort(){
+    const std::size_t count = keys.size();
+    std::vector<std::size_t> histograms(8 * 256, 0);
+    for(std::uint64_t key : keys){
+      for(int byte = 0; byte < 8; ++byte){
+	++histograms[256 * byte + ((key >> (8 * byte)) & 0xff)];
+      }
+    }
+    std::vector<std::uint64_t> buffer(count);
+    for(int byte = 0; byte < 8 && count > 0; ++byte){
+      std::size_t * histogram = &histograms[256 * byte];
+      if(histogram[(keys[0] >> (8 * byte)) & 0xff] == count){
+	continue;
+      }
+      // Convert the counts into the first output position of each bucket.
+      std::size_t position = 0;
+      for(int bucket = 0; bucket < 256; ++bucket){
+	std::size_t bucketCount = histogram[bucket];
+	histogram[bucket] = position;
+	position += bucketCount;
+      }
+      for(std::uint64_t key : keys){
+	buffer[histogram[(key >> (8 * byte)) & 0xff]++] = key;
+      }
+      keys.swap(buffer);
+    }
+  }
+
+  /* Write every value with exactly "precision" decimal places, one per
+   * line, formatting the digits directly into a large output buffer.
+   */
+  bool write(std::ostream & output) const {
+    std::vector<char> buffer(1 << 20);
+    std::size_t used = 0;
+    char digits[24];
+    for(std::uint64_t key : keys){
+      std::int64_t value = static_cast<std::int64_t>(key ^ signBit);
+      std::uint64_t magnitude = value < 0 ? 0 - static_cast<std::uint64_t>(value) : value;
+      // Digits are generated from least to most significant.
+      int digitCount = 0;
+      do{
+	digits[digitCount++] = static_cast<char>('0' + magnitude % 10);
+	magnitude /= 10;
+      } while(magnitude > 0 || digitCount <= precision);
+      if(buffer.size() - used < 32){
+	output.write(buffer.data(), used);
+	used = 0;
+      }
+      if(value < 0){
+	buffer[used++] = '-';
+      }
+      for(int digit = digitCount - 1; digit >= 0; --digit){
+	buffer[used++] = digits[digit];
+	if(digit == precision && precision > 0){
+	  buffer[used++] = '.';
+	}
+      }
+      buffer[used++] = '\n';
+    }
+    output.write(buffer.data(), used);
+    return output.good();
+  }
+
+  std::size_t size() const {
+    return keys.size();
+  }
+
+  int getPrecision() const {
+    return precision;
+  }
+
+  const std::string & getError() const {
+    return error;
+  }
+
+};
+
+/* Read fixed-precision values, radix sort them and write them with the
+ * same precision. Returns 0 on success, 1 if the input could not be read,
+ * 2 if the output could not be written, or 3 if the input is not in
+ * fixed-precision form.
+ */
+int sortFixedPrecision(std::istream & input, std::ostream & output, int precision){
+  FixedPrecisionValues values(precision);
+  bool parsed = forEachToken(input, [&values](const char * begin, const char * end){
+      return values.add(begin, end);
+    });
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+  if(!parsed){
+    std::cerr << "Fixed-precision mode: " << values.getError() << std::endl;
+    return 3;
+  }
+  values.sort();
+  if(!values.write(output)){
+    return 2;
+  }
+  std::cout << "Radix sorted " << values.size() << " values with " 
+	    << values.getPrecision() << " decimal places" << std::endl;
+  return 0;
+}
+
+/* COUNTING INSTEAD OF SORTING:
+ * ============================
+ * Often what is needed is not a sorted copy of every value, but how many
+ * times each value occurs. Both of the following modes read the input
+ * ONCE, and their memory use depends only on the number of DISTINCT
+ * values or BINS, not on the number of values read.
+ *
+ * 1) DISTINCT mode counts each distinct value using a HASH TABLE
+ *    (std::unordered_map), which finds a value's count in constant time
+ *    on average. Only the distinct values are finally sorted.
+ * 2) HISTOGRAM mode counts values in a fixed number of equal-width bins
+ *    between a minimum and maximum value, using a plain std::vector.
+ */
+
+// Convert a token to a double. Returns false if it is not a number.
+bool parseDouble(const char * begin, const char * end, double & value){
+  // std::strtod requires a null-terminated string.
+  std::string token(begin, end);
+  char * parsedEnd = nullptr;
+  value = std::strtod(token.c_str(), &parsedEnd);
+  return parsedEnd == token.c_str() + token.size() && !token.empty() && value == value;
+}
+
+/* Write a value with the fewest digits that read back as the same value:
+ * 15 significant digits are enough for most values (6.92 stays "6.92"),
+ * while 17 always distinguish two different doubles.
+ */
+void writeShortest(std::ostream & output, double value){
+  char digits[32];
+  std::snprintf(digits, sizeof(digits), "%.15g", value);
+  if(std::strtod(digits, nullptr) != value){
+    std::snprintf(digits, sizeof(digits), "%.17g", value);
+  }
+  output << digits;
+}
+
+// Write "value count" lines for each distinct value in ascending order.
+int countDistinct(std::istream & input, std::ostream & output){
+  std::unordered_map<double, std::size_t> counts;
+  std::size_t valueCount(0);
+  std::string badToken;
+  bool parsed = forEachToken(input, [&](const char * begin, const char * end){
+      double value(0.0);
+      if(!parseDouble(begin, end, value)){
+	badToken.assign(begin, end);
+	return false;
+      }
+      // -0.0 and 0.0 compare equal but would hash differently.
+      ++counts[value == 0.0 ? 0.0 : value];
+      ++valueCount;
+      return true;
+    });
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+  if(!parsed){
+    std::cerr << "Distinct mode: \"" << badToken << "\" is not a number" << std::endl;
+    return 3;
+  }
+
+  std::vector<std::pair<double, std::size_t> > sortedCounts(counts.begin(), counts.end());
+  std::sort(sortedCounts.begin(), sortedCounts.end());
+  for(const std::pair<double, std::size_t> & valueAndCount : sortedCounts){
+    writeShortest(output, valueAndCount.first);
+    output << " " << valueAndCount.second << "\n";
+  }
+  if(!output.good()){
+    return 2;
+  }
+  std::cout << valueCount << " values, " << sortedCounts.size() << " distinct" << std::endl;
+  return 0;
+}
+
+/* Write "lowerEdge count" lines for each of binCount bins covering 
+ * [minimum, maximum]. Values outside this range are counted separately.
+ */
+int countHistogram(std::istream & input, std::ostream & output,
+		   std::size_t binCount, double minimum, double maximum){
+  if(binCount == 0 || !(maximum > minimum)){
+    std::cerr << "Histogram mode: need at least one bin and maximum > minimum" << std::endl;
+    return 3;
+  }
+  std::vector<std::size_t> bins(binCount, 0);
+  std::size_t underflow(0), overflow(0), valueCount(0);
+  const double binsPerUnit = binCount / (maximum - minimum);
+  std::string badToken;
+  bool parsed = forEachToken(input, [&](const char * begin, const char * end){
+      double value(0.0);
+      if(!parseDouble(begin, end, value)){
+	badToken.assign(begin, end);
+	return false;
+      }
+      ++valueCount;
+      if(value < minimum){
+	++underflow;
+      }
+      else if(value > maximum){
+	++overflow;
+      }
+      else{
+	// The maximum itself belongs in the last bin.
+	std::size_t bin = static_cast<std::size_t>((value - minimum) * binsPerUnit);
+	++bins[std::min(bin, binCount - 1)];
+      }
+      return true;
+    });
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+  if(!parsed){
+    std::cerr << "Histogram mode: \"" << badToken << "\" is not a number" << std::endl;
+    return 3;
+  }
+
+  output.precision(std::numeric_limits<double>::digits10);
+  for(std::size_t bin = 0; bin < binCount; ++bin){
+    output << minimum + bin / binsPerUnit << " " << bins[bin] << "\n";
+  }
+  if(!output.good()){
+    return 2;
+  }
+  std::cout << valueCount << " values in " << binCount << " bins, " << underflow 
+	    << " below " << minimum << ", " << overflow << " above " << maximum << std::endl;
+  return 0;
+}
+
+/* RECORD MODE:
+ * ============
+ * Real data files usually hold RECORDS: one per line, with several
+ * columns, e.g. "timestamp channel energy". Sorting such a file by one
+ * KEY column must carry the other columns along with the key.
+ *
+ * Sorting whole rows would MOVE every column of a row on every swap. 
+ * Instead each column is stored SEPARATELY, and only compact 
+ * (key, row index) pairs are sorted. The sorted row indices form a 
+ * PERMUTATION, which is then applied to each column in turn, moving each
+ * field exactly once.
+ *
+ * The key may be stored as a double (8 bytes), a float (4 bytes, with 
+ * less precision) or a 64-bit integer (8 bytes, exact). A float key with
+ * a 32-bit index makes each sorted pair only 8 bytes.
+ */
+
+/* Read lines from a stream in large blocks and call processLine(begin, 
+ * end) for each one, without the line ending. Stops early, returning
+ * false, if processLine returns false. Like forEachToken(), also returns
+ * false if the stream fails.
+ */
+template<typename LineFunction>
+bool forEachLine(std::istream & input, LineFunction processLine){
+  std::vector<char> block(1 << 20);
+  std::string carried; // A line that may continue in the next block
+  while(input){
+    input.read(block.data(), block.size());
+    const char * position = block.data();
+    const char * end = position + input.gcount();
+    while(position != end){
+      const char * lineEnd = static_cast<const char *>(std::memchr(position, '\n', end - position));
+      if(lineEnd == nullptr){
+	carried.append(position, end);
+	break;
+      }
+      if(!carried.empty()){
+	carried.append(position, lineEnd);
+	if(!processLine(carried.data(), carried.data() + carried.size())){
+	  return false;
+	}
+	carried.clear();
+      }
+      else if(!processLine(position, lineEnd)){
+	return false;
+      }
+      position = lineEnd + 1;
+    }
+  }
+  return !input.bad()
+    && (carried.empty() || processLine(carried.data(), carried.data() + carried.size()));
+}
+
+/* Split a line into fields separated by the delimiter, or by runs of
+ * whitespace if the delimiter is ' '. A trailing '\r' is ignored.
+ */
+void splitFields(const char * begin, const char * end, char delimiter,
+		 std::vector<std::pair<const char *, const char *> > & fields){
+  fields.clear();
+  if(begin != end && end[-1] == '\r'){
+    --end;
+  }
+  const char * position = begin;
+  while(position != end){
+    if(delimiter == ' '){
+      while(position != end && std::isspace(static_cast<unsigned char>(*position))){
+	++position;
+      }
+      if(position == end){
+	break;
+      }
+    }
+    const char * fieldBegin = position;
+    while(position != end && (delimiter == ' ' 
+			      ? !std::isspace(static_cast<unsigned char>(*position))
+			      : *position != delimiter)){
+      ++position;
+    }
+    fields.push_back(std::make_pair(fieldBegin, position));
+    if(delimiter != ' ' && position != end){
+      ++position;
+      if(position == end){
+	fields.push_back(std::make_pair(end, end)); // Empty last field
+      }
+    }
+  }
+}
+
+// Convert a key field to each of the supported key types.
+bool parseKey(const char * begin, const char * end, double & key){
+  return parseDouble(begin, end, key);
+}
+
+bool parseKey(const char * begin, const char * end, float & key){
+  double value(0.0);
+  if(!parseDouble(begin, end, value)){
+    return false;
+  }
+  key = static_cast<float>(value);
+  return true;
+}
+
+bool parseKey(const char * begin, const char * end, std::int64_t & key){
+  std::string token(begin, end);
+  char * parsedEnd = nullptr;
+  errno = 0;
+  key = std::strtoll(token.c_str(), &parsedEnd, 10);
+  return parsedEnd == token.c_str() + token.size() && !token.empty() && errno == 0;
+}
+
+// The text of one column of every record, stored contiguously.
+class TextColumn {
+
+  std::string text;
+  std::vector<std::uint64_t> ends; // Where each record's field ends
+
+public :
+
+  void add(const char * begin, const char * end){
+    text.append(begin, end);
+    ends.push_back(text.size());
+  }
+
+  const char * fieldBegin(std::size_t record) const {
+    return text.data() + (record == 0 ? 0 : ends[record - 1]);
+  }
+
+  const char * fieldEnd(std::size_t record) const {
+    return text.data() + ends[record];
+  }
+
+  // Reorder the fields so that field "record" becomes field order[record].
+  void permute(const std::vector<std::uint32_t> & order){
+    TextColumn sorted;
+    sorted.text.reserve(text.size());
+    sorted.ends.reserve(ends.size());
+    for(std::uint32_t record : order){
+      sorted.add(fieldBegin(record), fieldEnd(record));
+    }
+    std::swap(text, sorted.text);
+    std::swap(ends, sorted.ends);
+  }
+
+};
+
+/* Sort records by the (zero-based) key column and write the chosen 
+ * columns of each record, in sorted order. If no columns are chosen, 
+ * every column is written. Fields are separated by commas if the first
+ * line contains a comma, otherwise by whitespace.
+ */
+template<typename Key>
+int sortRecords(std::istream & input, std::ostream & output, const char * keyTypeName,
+		std::size_t keyColumn, std::vector<std::size_t> columns){
+  std::vector<Key> keys;
+  std::vector<TextColumn> payload;
+  std::vector<std::pair<const char *, const char *> > fields;
+  char delimiter('\0');
+  std::size_t lineNumber(0);
+  std::string error;
+  bool parsed = forEachLine(input, [&](const char * begin, const char * end){
+      ++lineNumber;
+      if(delimiter == '\0'){
+	delimiter = std::find(begin, end, ',') != end ? ',' : ' ';
+      }
+      splitFields(begin, end, delimiter, fields);
+      if(fields.empty()){
+	return true; // Skip blank lines.
+      }
+      if(columns.empty()){
+	for(std::size_t column = 0; column < fields.size(); ++column){
+	  columns.push_back(column);
+	}
+      }
+      if(payload.empty()){
+	payload.resize(columns.size());
+      }
+      std::size_t neededColumns = std::max(keyColumn, *std::max_element(columns.begin(), columns.end())) + 1;
+      if(fields.size() < neededColumns){
+	error = "has " + std::to_string(fields.size()) + " columns, "
+	  + std::to_string(neededColumns) + " needed";
+	return false;
+      }
+      Key key;
+      if(!parseKey(fields[keyColumn].first, fields[keyColumn].second, key)){
+	error = "key \"" + std::string(fields[keyColumn].first, fields[keyColumn].second)
+	  + "\" is not a valid " + keyTypeName;
+	return false;
+      }
+      if(keys.size() == std::numeric_limits<std::uint32_t>::max()){
+	error = "too many records for 32-bit record indices";
+	return false;
+      }
+      keys.push_back(key);
+      for(std::size_t slot = 0; slot < columns.size(); ++slot){
+	payload[slot].add(fields[columns[slot]].first, fields[columns[slot]].second);
+      }
+      return true;
+    });
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+  if(!parsed){
+    std::cerr << "Record mode: line " << lineNumber << " " << error << std::endl;
+    return 3;
+  }
+
+  // Sort only (key, record index) pairs. Equal keys keep their input order.
+  std::vector<std::pair<Key, std::uint32_t> > sortedKeys(keys.size());
+  for(std::size_t record = 0; record < keys.size(); ++record){
+    sortedKeys[record] = std::make_pair(keys[record], static_cast<std::uint32_t>(record));
+  }
+  std::vector<Key>().swap(keys);
+  std::sort(sortedKeys.begin(), sortedKeys.end());
+
+  std::vector<std::uint32_t> order(sortedKeys.size());
+  for(std::size_t record = 0; record < sortedKeys.size(); ++record){
+    order[record] = sortedKeys[record].second;
+  }
+  std::vector<std::pair<Key, std::uint32_t> >().swap(sortedKeys);
+
+  // Apply the permutation one column at a time.
+  for(TextColumn & column : payload){
+    column.permute(order);
+  }
+
+  std::string buffer;
+  for(std::size_t record = 0; record < order.size(); ++record){
+    for(std::size_t slot = 0; slot < payload.size(); ++slot){
+      if(slot > 0){
+	buffer += delimiter;
+      }
+      buffer.append(payload[slot].fieldBegin(record), payload[slot].fieldEnd(record));
+    }
+    buffer += '\n';
+    if(buffer.size() >= (1 << 20)){
+      output.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  output.write(buffer.data(), buffer.size());
+  if(!output.good()){
+    return 2;
+  }
+  std::cout << "Sorted " << order.size() << " records by column " << keyColumn + 1
+	    << " using " << keyTypeName << " keys (" << sizeof(std::pair<Key, std::uint32_t>)
+	    << " bytes per sorted pair)" << std::endl;
+  return 0;
+}
+
+/* Parse a command line argument that must be a whole number between 1
+ * and maximum. Returns false if it is not.
+ */
+bool parseCount(const char * argument, unsigned long maximum, unsigned long & count){
+  char * parsedEnd = nullptr;
+  errno = 0;
+  count = std::strtoul(argument, &parsedEnd, 10);
+  return parsedEnd != argument && *parsedEnd == '\0' && errno == 0 && argument[0] != '-'
+    && count >= 1 && count <= maximum;
+}
+
+// Largest column number in records mode.
+const unsigned long maximumColumnNumber = 1000000;
+
+/* Parse a comma-separated list of one-based column numbers, e.g. "1,3",
+ * into zero-based column indices. Returns false if it is malformed.
+ */
+bool parseColumnList(const std::string & list, std::vector<std::size_t> & columns){
+  columns.clear();
+  std::size_t position(0);
+  while(position <= list.size()){
+    std::size_t comma = std::min(list.find(',', position), list.size());
+    std::string number = list.substr(position, comma - position);
+    unsigned long column(0);
+    if(!parseCount(number.c_str(), maximumColumnNumber, column)){
+      return false;
+    }
+    columns.push_back(column - 1);
+    position = comma + 1;
+  }
+  return true;
+}
+
+/* Read numbers, sort them and write them, like the default mode but
+ * without listing every value on the terminal.
+ */
+int sortValues(std::istream & input, std::ostream & output){
+  std::vector<double> values;
+  std::string badToken;
+  bool parsed = forEachToken(input, [&](const char * begin, const char * end){
+      double value(0.0);
+      if(!parseDouble(begin, end, value)){
+	badToken.assign(begin, end);
+	return false;
+      }
+      values.push_back(value);
+      return true;
+    });
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+  if(!parsed){
+    std::cerr << "Sort mode: \"" << badToken << "\" is not a number" << std::endl;
+    return 3;
+  }
+  std::sort(values.begin(), values.end());
+  for(double value : values){
+    output << value << "\n";
+  }
+  if(!output.good()){
+    return 2;
+  }
+  std::cout << "Sorted " << values.size() << " values" << std::endl;
+  return 0;
+}
+
+/* NUMA MODE:
+ * ==========
+ * The default mode fills ONE std::vector from ONE thread, so all of its
+ * pages are placed on that thread's NUMA node (see numaStorage.h). This
+ * mode instead splits the input text into one chunk per thread and:
+ *
+ * 1) Each thread COUNTS the numbers in its chunk. A PREFIX SUM of the
+ *    counts, each rounded up to whole huge pages, gives the position of
+ *    each chunk's first number. No huge page then holds the numbers of
+ *    two threads, which would place it on only one of their nodes.
+ * 2) Each thread, pinned to a processor of its own node (threads are
+ *    spread round-robin across the nodes), FIRST TOUCHES and parses its
+ *    own range of a huge-page buffer, then sorts that range.
+ * 3) Pairs of sorted ranges are MERGED in parallel rounds until one
+ *    sorted range remains, closing up the gaps between the ranges. Each
+ *    merge runs on the node that holds the start of its first range.
+ *
+ * The node of the pages of each thread's range is reported next to the
+ * node that the thread ran on, to confirm that each thread works on 
+ * local memory.
+ */
+
+/* Print the nodes on which the pages of one thread's range were found.
+ * threadNode is -1 if the thread could not be pinned to a node.
+ */
+void reportPlacement(std::size_t thread, int threadNode, const PagePlacement & placement){
+  std::cout << "  thread " << thread;
+  if(threadNode >= 0){
+    std::cout << " (on node " << threadNode << ")";
+  }
+  else{
+    std::cout << " (not pinned)";
+  }
+  std::cout << ":";
+  if(!placement.supported){
+    std::cout << " placement unavailable" << std::endl;
+    return;
+  }
+  for(std::size_t node = 0; node < placement.pagesOnNode.size(); ++node){
+    if(placement.pagesOnNode[node] > 0){
+      std::cout << " node " << node << " " << placement.pagesOnNode[node] << " pages";
+    }
+  }
+  if(placement.pagesNotPresent > 0){
+    std::cout << " (" << placement.pagesNotPresent << " not present)";
+  }
+  if(placement.pagesOnNode.empty() && placement.pagesNotPresent == 0){
+    std::cout << " empty";
+  }
+  std::cout << std::endl;
+}
+
+int sortValuesNuma(std::istream & input, std::ostream & output, std::size_t threadCount,
+		   bool explicitHugePages){
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  const NumaTopology topology;
+
+  // The text is read once, sequentially, so ordinary memory is used.
+  std::string text;
+  std::vector<char> block(1 << 20);
+  while(input){
+    input.read(block.data(), block.size());
+    text.append(block.data(), input.gcount());
+  }
+  // A read error is reported by runMode(); nothing is written.
+  if(input.bad()){
+    return 1;
+  }
+
+  // Chunk boundaries are moved forward to whitespace so no number is split.
+  std::vector<std::size_t> chunkBegin(threadCount + 1, text.size());
+  chunkBegin[0] = 0;
+  for(std::size_t chunk = 1; chunk < threadCount; ++chunk){
+    std::size_t boundary = std::max(chunkBegin[chunk - 1], text.size() / threadCount * chunk);
+    while(boundary < text.size() && !std::isspace(static_cast<unsigned char>(text[boundary]))){
+      ++boundary;
+    }
+    chunkBegin[chunk] = boundary;
+  }
+
+  // 1) Count the numbers in each chunk in parallel, then prefix sum.
+  std::vector<std::size_t> chunkValues(threadCount, 0);
+  std::vector<std::thread> threads;
+  for(std::size_t chunk = 0; chunk < threadCount; ++chunk){
+    threads.push_back(std::thread([&, chunk](){
+	  std::size_t count(0);
+	  bool inToken(false);
+	  for(std::size_t position = chunkBegin[chunk]; position < chunkBegin[chunk + 1]; ++position){
+	    bool space = std::isspace(static_cast<unsigned char>(text[position])) != 0;
+	    count += !space && !inToken;
+	    inToken = !space;
+	  }
+	  chunkValues[chunk] = count;
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  threads.clear();
+  // Each chunk's range starts on a huge page boundary; the gaps are unused.
+  const std::size_t pageValues = HugePageBuffer<double>::elementsPerHugePage;
+  std::vector<std::size_t> firstValue(threadCount + 1, 0);
+  std::size_t valueCount(0);
+  for(std::size_t chunk = 0; chunk < threadCount; ++chunk){
+    valueCount += chunkValues[chunk];
+    firstValue[chunk + 1] = (firstValue[chunk] + chunkValues[chunk] + pageValues - 1)
+      / pageValues * pageValues;
+  }
+
+  // Neither buffer is touched until the worker threads fill them.
+  HugePageBuffer<double> values(firstValue[threadCount], explicitHugePages);
+  HugePageBuffer<double> merged(firstValue[threadCount], explicitHugePages);
+  if(!values.valid() || !merged.valid()){
+    std::cerr << "NUMA mode: cannot allocate memory for " << valueCount << " values" << std::endl;
+    return 3;
+  }
+  Clock::time_point counted = Clock::now();
+
+  // 2) Each pinned thread first touches, parses and sorts its own range.
+  std::vector<std::string> badTokens(threadCount);
+  std::vector<char> pinned(threadCount, false);
+  for(std::size_t chunk = 0; chunk < threadCount; ++chunk){
+    threads.push_back(std::thread([&, chunk](){
+	  pinned[chunk] = topology.pin(chunk);
+	  double * value = values.data() + firstValue[chunk];
+	  // The merge buffer's range, gap included, is first touched by the same thread.
+	  std::fill(merged.data() + firstValue[chunk], merged.data() + firstValue[chunk + 1], 0.0);
+	  const char * position = text.c_str() + chunkBegin[chunk];
+	  const char * end = text.c_str() + chunkBegin[chunk + 1];
+	  for(;;){
+	    while(position != end && std::isspace(static_cast<unsigned char>(*position))){
+	      ++position;
+	    }
+	    if(position == end){
+	      break;
+	    }
+	    char * parsedEnd = nullptr;
+	    *value = std::strtod(position, &parsedEnd);
+	    // std::strtod stops at the whitespace (or '\0') ending each token.
+	    if(parsedEnd == position || (parsedEnd != end && !std::isspace(static_cast<unsigned char>(*parsedEnd)))
+	       || *value != *value){
+	      const char * tokenEnd = position;
+	      while(tokenEnd != end && !std::isspace(static_cast<unsigned char>(*tokenEnd))){
+		++tokenEnd;
+	      }
+	      badTokens[chunk].assign(position, tokenEnd);
+	      return;
+	    }
+	    ++value;
+	    position = parsedEnd;
+	  }
+	  std::sort(values.data() + firstValue[chunk], value);
+	}));
+  }
+  for(std::thread & thread : threads){
+    thread.join();
+  }
+  threads.clear();
+  for(const std::string & badToken : badTokens){
+    if(!badToken.empty()){
+      std::cerr << "NUMA mode: \"" << badToken << "\" is not a number" << std::endl;
+      return 3;
+    }
+  }
+  Clock::time_point sorted = Clock::now();
+
+  std::cout << "Page placement of each thread's range ("
+	    << (values.usesExplicitHugePages() ? "explicit" : "transparent")
+	    << " huge pages requested):" << std::endl;
+  for(std::size_t chunk = 0; chunk < threadCount; ++chunk){
+    reportPlacement(chunk, pinned[chunk] ? topology.nodeOfThread(chunk) : -1,
+		    pagePlacement(values.data() + firstValue[chunk],
+				  values.data() + firstValue[chunk] + chunkValues[chunk]));
+  }
+
+  /* 3) Merge pairs of sorted ranges in parallel rounds. Each range also
+   * records the chunk whose thread first touched its start, so that it
+   * can be merged on that thread's node in every round. A merged range
+   * starts where its first range did, so the last range ends at 
+   * valueCount.
+   */
+  std::vector<std::size_t> rangeBegin(threadCount), rangeEnd(threadCount), rangeChunk(threadCount);
+  for(std::size_t chunk = 0; chunk < threadCount; ++chunk){
+    rangeBegin[chunk] = firstValue[chunk];
+    rangeEnd[chunk] = firstValue[chunk] + chunkValues[chunk];
+    rangeChunk[chunk] = chunk;
+  }
+  double * source = values.data();
+  double * target = merged.data();
+  while(rangeBegin.size() > 1){
+    std::vector<std::size_t> mergedBegin, mergedEnd, mergedChunk;
+    for(std::size_t range = 0; range < rangeBegin.size(); range += 2){
+      std::size_t first = rangeBegin[range];
+      std::size_t firstEnd = rangeEnd[range];
+      // A last range without a partner is merged with an empty range.
+      bool paired = range + 1 < rangeBegin.size();
+      std::size_t second = paired ? rangeBegin[range + 1] : firstEnd;
+      std::size_t secondEnd = paired ? rangeEnd[range + 1] : firstEnd;
+      std::size_t chunk = rangeChunk[range];
+      mergedBegin.push_back(first);
+      mergedEnd.push_back(first + (firstEnd - first) + (secondEnd - second));
+      mergedChunk.push_back(chunk);
+      threads.push_back(std::thread([=, &topology](){
+	    // Run on the node whose memory holds the start of the first range.
+	    topology.pin(chunk);
+	    std::merge(source + first, source + firstEnd, source + second, source + secondEnd,
+		       target + first);
+	  }));
+    }
+    for(std::thread & thread : threads){
+      thread.join();
+    }
+    threads.clear();
+    rangeBegin.swap(mergedBegin);
+    rangeEnd.swap(mergedEnd);
+    rangeChunk.swap(mergedChunk);
+    std::swap(source, target);
+  }
+  Clock::time_point finished = Clock::now();
+
+  for(std::size_t index = 0; index < valueCount; ++index){
+    output << source[index] << "\n";
+  }
+  if(!output.good()){
+    return 2;
+  }
+  typedef std::chrono::duration<double, std::milli> Milliseconds;
+  std::cout << "Sorted " << valueCount << " values with " << threadCount << " threads: "
+	    << "read and count " << Milliseconds(counted - start).count() << " ms, "
+	    << "parse and sort " << Milliseconds(sorted - counted).count() << " ms, "
+	    << "merge " << Milliseconds(finished - sorted).count() << " ms" << std::endl;
+  return 0;
+}
+
+// Largest number of histogram bins, which keeps the bin counts in memory.
+const unsigned long maximumBinCount = 100000000;
+
+// Largest number of threads in NUMA mode.
+const unsigned long maximumThreadCount = 1024;
+
+/* ALTERNATIVE MODES:
+ * ==================
+ * A third command line argument selects an alternative way to process
+ * the input file:
+ *
+ *   sort              : Sort the values without listing them on the
+ *                       terminal. Used for compressed files when no mode
+ *                       is given.
+ *   fixed [precision] : Sort fixed-precision decimal values exactly using
+ *                       radix sort. The precision is detected from the 
+ *                       input unless it is given.
+ *   distinct          : Write each distinct value and its count.
+ *   histogram bins minimum maximum
+ *                     : Write the lower edge and count of each bin.
+ *   numa [threads] [explicit]
+ *                     : Parse and sort on several threads, each using
+ *                       memory on its own NUMA node, in huge pages
+ *                       ("explicit" requests reserved huge pages).
+ *   records keyColumn [keyType] [columns]
+ *                     : Sort multi-column records by one column. The 
+ *                       key type is double (default), float or int64.
+ *                       Columns are numbered from 1, and the columns to
+ *                       write are listed as e.g. "1,3" (default all).
+ *
+ * In every mode the input file may be gzip or Zstandard compressed, and
+ * the output file is compressed if its name ends in ".gz" or ".zst" (see
+ * compressedStreams.h).
+ */
+int runMode(int argc, char * argv[]){
+  std::string mode(argc > 3 ? argv[3] : "sort");
+  if(mode != "sort" && mode != "fixed" && mode != "distinct" && mode != "histogram"
+     && mode != "records" && mode != "numa"){
+    std::cerr << "Unknown mode \"" << mode << "\"" << std::endl;
+    return 4; // 4 indicates an unknown mode.
+  }
+  unsigned long binCount(0);
+  double minimum(0.0), maximum(0.0);
+  if(mode == "histogram"
+     && (argc < 7 || !parseCount(argv[4], maximumBinCount, binCount)
+	 || !parseDouble(argv[5], argv[5] + std::strlen(argv[5]), minimum)
+	 || !parseDouble(argv[6], argv[6] + std::strlen(argv[6]), maximum)
+	 || !std::isfinite(minimum) || !std::isfinite(maximum) || !(minimum < maximum))){
+    std::cerr << "Usage: " << argv[0] << " input output histogram bins minimum maximum\n"
+	      << "  bins must be a whole number from 1 to " << maximumBinCount << "\n"
+	      << "  minimum and maximum must be finite numbers with minimum < maximum" << std::endl;
+    return 4;
+  }
+  // Fixed mode detects the precision from the input unless it is given.
+  long precision(-1);
+  if(mode == "fixed" && argc > 4){
+    char * parsedEnd = nullptr;
+    errno = 0;
+    precision = std::strtol(argv[4], &parsedEnd, 10);
+    if(parsedEnd == argv[4] || *parsedEnd != '\0' || errno != 0
+       || precision < 0 || precision > maximumFixedDigits){
+      std::cerr << "Usage: " << argv[0] << " input output fixed [precision]\n"
+		<< "  precision must be a whole number from 0 to " << maximumFixedDigits << std::endl;
+      return 4;
+    }
+  }
+  unsigned long threadCount = std::max(1u, std::thread::hardware_concurrency());
+  if(mode == "numa" && argc > 4 && !parseCount(argv[4], maximumThreadCount, threadCount)){
+    std::cerr << "Usage: " << argv[0] << " input output numa [threads] [explicit]\n"
+	      << "  threads must be a whole number from 1 to " << maximumThreadCount << std::endl;
+    return 4;
+  }
+  std::string keyType(argc > 5 ? argv[5] : "double");
+  unsigned long keyColumn(0);
+  std::vector<std::size_t> columns;
+  if(mode == "records" && (argc < 5 || !parseCount(argv[4], maximumColumnNumber, keyColumn)
+			   || (keyType != "double" && keyType != "float" && keyType != "int64")
+			   || (argc > 6 && !parseColumnList(argv[6], columns)))){
+    std::cerr << "Usage: " << argv[0] << " input output records keyColumn "
+	      << "[double|float|int64] [column,column,...]\n"
+	      << "  columns are whole numbers from 1 to " << maximumColumnNumber << std::endl;
+    return 4;
+  }
+  std::unique_ptr<std::istream> inputFile = openInputFile(argv[1]);
+  if(!inputFile){
+    return 1;
+  }
+  std::unique_ptr<std::ostream> outputFile = openOutputFile(argv[2]);
+  if(!outputFile){
+    return 2;
+  }
+  int result(0);
+  if(mode == "sort"){
+    result = sortValues(*inputFile, *outputFile);
+  }
+  else if(mode == "distinct"){
+    result = countDistinct(*inputFile, *outputFile);
+  }
+  else if(mode == "numa"){
+    bool explicitHugePages = argc > 5 && std::string(argv[5]) == "explicit";
+    result = sortValuesNuma(*inputFile, *outputFile, threadCount, explicitHugePages);
+  }
+  else if(mode == "records"){
+    if(keyType == "float"){
+      result = sortRecords<float>(*inputFile, *outputFile, "float", keyColumn - 1, columns);
+    }
+    else if(keyType == "int64"){
+      result = sortRecords<std::int64_t>(*inputFile, *outputFile, "int64", keyColumn - 1, columns);
+    }
+    else{
+      result = sortRecords<double>(*inputFile, *outputFile, "double", keyColumn - 1, columns);
+    }
+  }
+  else if(mode == "histogram"){
+    result = countHistogram(*inputFile, *outputFile, binCount, minimum, maximum);
+  }
+  else{
+    result = sortFixedPrecision(*inputFile, *outputFile, static_cast<int>(precision));
+  }
+  // A corrupt compressed file is only discovered while it is being read.
+  if(inputFile->bad()){
+    std::cerr << "Error reading " << argv[1] << std::endl;
+    result = 1;
+  }
+  else{
+    // Compressed output is only completely written when it is flushed.
+    outputFile->flush();
+    if(result == 0 && !outputFile->good()){
+      result = 2;
+    }
+  }
+  /* Remove the empty or partial output file of a failed run, so that it
+   * cannot be mistaken for a result. Only regular files are removed, not
+   * e.g. /dev/stdout.
+   */
+  if(result != 0){
+    outputFile.reset();
+    struct stat outputStatus;
+    if(::stat(argv[2], &outputStatus) == 0 && S_ISREG(outputStatus.st_mode)){
+      std::remove(argv[2]);
+    }
+  }
+  return result;
+}
+
+// True if either file needs to be decompressed or compressed.
+bool isCompressed(const char * inputName, const char * outputName){
+  return detectCompression(inputName) != UNCOMPRESSED
+    || compressionFromName(outputName) != UNCOMPRESSED;
+}
+
 /* This short example of the capabilities of the STL perorms the following
  * functions:
  * 1) Reads an unsorted list of numbers from a text file specified using 
@@ -23,6 +1142,13 @@
  */
 int main(int argc, char * argv[]){
 
+  /* A third command line argument selects one of the alternative modes,
+   * which are also used for compressed files.
+   */
+  if(argc > 3 || (argc == 3 && isCompressed(argv[1], argv[2]))){
+    return runMode(argc, argv);
+  }
+
   /* Instantiate a vector of double-precision values to store the
    * the numbers that are read from the input file.
    *